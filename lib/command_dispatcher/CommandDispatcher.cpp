@@ -0,0 +1,123 @@
+#include <CommandDispatcher.h>
+#include <Arduino.h>
+#include <env.h>
+
+// Length of COMMAND_PREFIX
+#define COMMAND_PREFIX_LENGTH (sizeof(COMMAND_PREFIX) - 1)
+
+
+//? Arguments
+uint8_t CommandArguments::count() const {
+  return this->token_count;
+}
+
+bool CommandArguments::get_uint(uint8_t index, uint32_t &value) const {
+  if(index >= this->token_count) return false;
+
+  return CommandDispatcher::parse_uint(this->tokens[index].start, this->tokens[index].length, value);
+}
+
+bool CommandArguments::get_int(uint8_t index, int32_t &value) const {
+  if(index >= this->token_count) return false;
+
+  const Token &token = this->tokens[index];
+  bool negative = token.length > 0 && token.start[0] == '-';
+  uint8_t offset = negative ? 1 : 0;
+
+  uint32_t magnitude;
+  if(!CommandDispatcher::parse_uint(token.start + offset, token.length - offset, magnitude)) return false;
+  if(magnitude > (negative ? 2147483648UL : 2147483647UL)) return false;
+
+  value = negative ? (int32_t) (0U - magnitude) : (int32_t) magnitude;
+  return true;
+}
+
+bool CommandArguments::equals(uint8_t index, const char *text) const {
+  if(index >= this->token_count) return false;
+
+  const Token &token = this->tokens[index];
+  return strlen(text) == token.length && memcmp(token.start, text, token.length) == 0;
+}
+
+
+
+//? Dispatcher
+bool CommandDispatcher::on(const char *name, CommandHandler handler) {
+  size_t name_length = strlen(name);
+  if(name_length == 0 || name_length > COMMAND_MAX_NAME_LENGTH) return false;
+  if(this->entry_count >= COMMAND_MAX_HANDLERS) return false;
+
+  this->entries[this->entry_count++] = {name, (uint8_t) name_length, handler};
+  return true;
+}
+
+bool CommandDispatcher::is_command(const uint8_t *payload, size_t length) {
+  return length >= COMMAND_PREFIX_LENGTH && memcmp(payload, COMMAND_PREFIX, COMMAND_PREFIX_LENGTH) == 0;
+}
+
+CommandStatus CommandDispatcher::dispatch(const uint8_t *payload, size_t length, uint32_t &id) {
+  id = 0;
+  if(!CommandDispatcher::is_command(payload, length)) return COMMAND_MALFORMED;
+
+  const char *cursor = (const char *) payload + COMMAND_PREFIX_LENGTH;
+  const char *end = (const char *) payload + length;
+
+  // The library ends text with a null that isn't part of the length, don't count on it either way
+  const char *terminator = (const char *) memchr(cursor, '\0', end - cursor);
+  if(terminator != nullptr) end = terminator;
+
+  // Split "<id>,<name>,<argument>..." on commas, the first two tokens are id and name
+  CommandArguments::Token tokens[COMMAND_MAX_ARGUMENTS + 2];
+  uint8_t token_count = 0;
+  while(cursor <= end) {
+    const char *comma = (const char *) memchr(cursor, ',', end - cursor);
+    const char *token_end = comma != nullptr ? comma : end;
+
+    if(token_count >= COMMAND_MAX_ARGUMENTS + 2 || token_end - cursor > 255) return COMMAND_BAD_ARGUMENTS;
+    tokens[token_count++] = {cursor, (uint8_t) (token_end - cursor)};
+
+    cursor = token_end + 1;
+  }
+
+  if(token_count < 2 || !CommandDispatcher::parse_uint(tokens[0].start, tokens[0].length, id)) {
+    id = 0;
+    return COMMAND_MALFORMED;
+  }
+
+  const CommandArguments::Token &name = tokens[1];
+  for(uint8_t index = 0; index < this->entry_count; index++) {
+    const Entry &entry = this->entries[index];
+    if(entry.name_length != name.length || memcmp(entry.name, name.start, name.length) != 0) continue;
+
+    CommandArguments arguments;
+    arguments.token_count = token_count - 2;
+    memcpy(arguments.tokens, tokens + 2, arguments.token_count * sizeof(CommandArguments::Token));
+
+    #ifdef SHOW_INFO
+    Serial.printf("[CommandDispatcher] Running command #%u: %s\n", id, entry.name);
+    #endif
+
+    return entry.handler(arguments);
+  }
+
+  #ifdef SHOW_WARN
+  Serial.printf("[CommandDispatcher] Unknown command #%u: %.*s\n", id, name.length, name.start);
+  #endif
+
+  return COMMAND_UNKNOWN;
+}
+
+bool CommandDispatcher::parse_uint(const char *start, uint8_t length, uint32_t &value) {
+  if(length == 0 || length > 10) return false;
+
+  uint64_t result = 0;
+  for(uint8_t index = 0; index < length; index++) {
+    if(start[index] < '0' || start[index] > '9') return false;
+    result = result * 10 + (start[index] - '0');
+  }
+
+  if(result > 0xFFFFFFFFULL) return false;
+
+  value = (uint32_t) result;
+  return true;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Number of commands that can be registered
+#define COMMAND_MAX_HANDLERS 8
+
+// Most arguments a command can take
+#define COMMAND_MAX_ARGUMENTS 17
+
+// Longest command name
+#define COMMAND_MAX_NAME_LENGTH 15
+
+// Prefix of every command message from the server
+#define COMMAND_PREFIX "cmd="
+
+/**
+ * @brief Result of a command, sent back in its acknowledgement
+ */
+enum CommandStatus : uint8_t
+{
+  COMMAND_OK = 0,
+  COMMAND_UNKNOWN = 1,        // No handler for the command name
+  COMMAND_BAD_ARGUMENTS = 2,  // Missing, malformed or out of range arguments
+  COMMAND_FAILED = 3,         // Arguments were fine but the command couldn't be done
+  COMMAND_MALFORMED = 4,      // Not a command message at all
+};
+
+/**
+ * @brief Arguments of a command, pointing straight into the received message
+ */
+class CommandArguments
+{
+public:
+  /**
+   * @brief Get the number of arguments
+   */
+  uint8_t count() const;
+
+  /**
+   * @brief Read an argument as an unsigned number
+   * @return false if there's no such argument or it isn't a number that fits
+   */
+  bool get_uint(uint8_t index, uint32_t &value) const;
+
+  /**
+   * @brief Read an argument as a signed number
+   * @return false if there's no such argument or it isn't a number that fits
+   */
+  bool get_int(uint8_t index, int32_t &value) const;
+
+  /**
+   * @brief Check if an argument is exactly some text
+   */
+  bool equals(uint8_t index, const char *text) const;
+
+private:
+  friend class CommandDispatcher;
+
+  struct Token
+  {
+    const char *start;
+    uint8_t length;
+  };
+
+  Token tokens[COMMAND_MAX_ARGUMENTS];
+  uint8_t token_count = 0;
+};
+
+/**
+ * @brief Handles one command
+ * @return status sent back to the server
+ */
+typedef CommandStatus (*CommandHandler)(const CommandArguments &arguments);
+
+/**
+ * @brief Parse commands from the server and run their handlers
+ * @details Messages are "cmd=<id>,<name>[,<argument>...]" and are parsed in place, nothing is copied or allocated.
+ *          The id is chosen by the server and comes back in the acknowledgement "ack=<id>,<status>".
+ * 
+ * example usage:
+ * @code
+ * CommandDispatcher command_dispatcher;
+ * 
+ * CommandStatus on_interval(const CommandArguments &arguments) {
+ *  uint32_t interval;
+ *  if(!arguments.get_uint(0, interval)) return COMMAND_BAD_ARGUMENTS;
+ *  report_interval = interval;
+ *  return COMMAND_OK;
+ * }
+ * 
+ * void setup() {
+ *  command_dispatcher.on("interval", on_interval);
+ * }
+ * 
+ * void on_websocket_data(WEBSOCKET_DATA) {
+ *  uint32_t id;
+ *  CommandStatus status = command_dispatcher.dispatch(payload, length, id);
+ *  if(status != COMMAND_MALFORMED) { ... send "ack=<id>,<status>" ... }
+ * }
+ * @endcode
+ */
+class CommandDispatcher
+{
+public:
+  /**
+   * @brief Register the handler of a command
+   * @param name command name, must outlive the dispatcher (a string literal)
+   * @return false if the name is too long or there are already COMMAND_MAX_HANDLERS commands
+   */
+  bool on(const char *name, CommandHandler handler);
+
+  /**
+   * @brief Check if a message is a command
+   */
+  static bool is_command(const uint8_t *payload, size_t length);
+
+  /**
+   * @brief Parse a command message and run its handler
+   * @param id filled with the command id, 0 if the message is malformed
+   * @return status of the command, COMMAND_MALFORMED if the message isn't a command
+   */
+  CommandStatus dispatch(const uint8_t *payload, size_t length, uint32_t &id);
+
+private:
+  struct Entry
+  {
+    const char *name;
+    uint8_t name_length;
+    CommandHandler handler;
+  };
+
+  Entry entries[COMMAND_MAX_HANDLERS];
+  uint8_t entry_count = 0;
+
+  static bool parse_uint(const char *start, uint8_t length, uint32_t &value);
+
+  friend class CommandArguments;
+};
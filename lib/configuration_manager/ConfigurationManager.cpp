@@ -3,6 +3,7 @@
 #include <Preferences.h>
 #include <NimBLEDevice.h>
 #include <WiFi.h>
+#include <esp32/rom/crc.h>
 
 
 // Helper Definitions
@@ -81,6 +82,8 @@ bool ConfigurationManager::is_ble_active = false;
 
 String ConfigurationManager::data_chunked = "";
 
+DeviceConfig ConfigurationManager::config = {};
+
 
 // Configuration Manager Static Functions
 bool ConfigurationManager::start_config_mode() {
@@ -207,96 +210,126 @@ bool ConfigurationManager::stop_config_mode() {
 }
 
 
-void ConfigurationManager::get_wifi_creds(String &ssid_container, String &pass_container) {
-  preferences.begin("wms-dev", true);
+//? Configuration Blob
+bool ConfigurationManager::begin() {
+  preferences.begin(CONFIG_NAMESPACE, true);
+  size_t length = preferences.getBytes(CONFIG_BLOB_KEY, &ConfigurationManager::config, sizeof(DeviceConfig));
+  preferences.end();
 
-  ssid_container = ConfigurationManager::get_string("wifi-ssid");
-  pass_container = ConfigurationManager::get_string("wifi-pass");
+  const DeviceConfig &config = ConfigurationManager::config;
+  if(length == sizeof(DeviceConfig)
+    && config.version == CONFIG_VERSION
+    && config.size == sizeof(DeviceConfig)
+    && config.crc == ConfigurationManager::get_crc(config)) {
+    #ifdef SHOW_INFO
+    Serial.println("[Configuration] Configuration loaded");
+    #endif
+    return true;
+  }
 
-  preferences.end();
-}
+  #ifdef SHOW_WARN
+  if(length != 0) Serial.println("[Configuration] Stored configuration is damaged or outdated, using the defaults");
+  #endif
 
+  ConfigurationManager::load_defaults();
 
+  // First boot after an update from the per-key storage
+  if(ConfigurationManager::migrate_legacy_keys()) {
+    #ifdef SHOW_INFO
+    Serial.println("[Configuration] Moved the old configuration into the blob");
+    #endif
+  }
 
-void ConfigurationManager::set_wifi_ssid(String &new_ssid) {
-  #ifdef SHOW_INFO
-  Serial.println("[Configuration] Saving new WiFi SSID...");
-  #endif
-  
-  ConfigurationManager::set_string("wifi-ssid", new_ssid);
+  return false;
+}
 
-  #ifdef SHOW_INFO
-  Serial.println("[Configuration] New WiFi SSID saved!");
-  #endif
+const DeviceConfig &ConfigurationManager::get_config() {
+  return ConfigurationManager::config;
 }
 
-void ConfigurationManager::set_wifi_pass(String &new_pass) {
-  #ifdef SHOW_INFO
-  Serial.println("[Configuration] Saving new WiFi password...");
-  #endif
+bool ConfigurationManager::set_config(const DeviceConfig &config) {
+  ConfigurationManager::config = config;
+  return ConfigurationManager::save();
+}
 
-  ConfigurationManager::set_string("wifi-pass", new_pass);
+void ConfigurationManager::load_defaults() {
+  DeviceConfig &config = ConfigurationManager::config;
+  config = {};
+  config.version = CONFIG_VERSION;
+  config.size = sizeof(DeviceConfig);
+  memset(config.sensor_pins, CONFIG_PIN_UNSET, sizeof(config.sensor_pins));
+  memset(config.buzzer_pins, CONFIG_PIN_UNSET, sizeof(config.buzzer_pins));
+}
 
-  #ifdef SHOW_INFO
-  Serial.println("[Configuration] New WiFi password saved!");
+bool ConfigurationManager::save() {
+  DeviceConfig &config = ConfigurationManager::config;
+  config.version = CONFIG_VERSION;
+  config.size = sizeof(DeviceConfig);
+  config.crc = ConfigurationManager::get_crc(config);
+
+  preferences.begin(CONFIG_NAMESPACE, false);
+  size_t length = preferences.putBytes(CONFIG_BLOB_KEY, &config, sizeof(DeviceConfig));
+  preferences.end();
+
+  #ifdef SHOW_WARN
+  if(length != sizeof(DeviceConfig)) Serial.println("[Configuration] Failed to save the configuration");
   #endif
+
+  return length == sizeof(DeviceConfig);
 }
 
-void ConfigurationManager::set_string(const char* key, String &value) {
-  preferences.begin("wms-dev", false);
+uint32_t ConfigurationManager::get_crc(const DeviceConfig &config) {
+  return crc32_le(0, (const uint8_t *) &config, offsetof(DeviceConfig, crc));
+}
 
-  // Check if the value length is less than 16
-  if(value.length() < 10) {
-    preferences.putString(key, value);
 
-    String key_ps = "ps-" + String(key);
-    preferences.putShort(key_ps.c_str(), 0);
-  }
 
-  // If the value length is more than 16
-  else {
-    String current_value = "";
-    uint8_t character_index = 0;
-    uint8_t current_partition = 0;
+//? Legacy Storage
+bool ConfigurationManager::migrate_legacy_keys() {
+  DeviceConfig &config = ConfigurationManager::config;
+  bool found = false;
 
-    // Loop through characters of the value
-    for(char c : value) {
-      character_index++;
-      current_value += c;
-      
-      // If the number of characters 10 or above 
-      if(character_index >= 10) {
+  preferences.begin(CONFIG_NAMESPACE, false);
 
-        // Save the part
-        String key_partition = String(key) + "-" + String(current_partition);
-        preferences.putString(key_partition.c_str(), current_value);
-        Serial.printf("Partition Part-%d Info: %s\n", current_partition, current_value);
-        
-        current_value = "";
-        character_index = 0;
-        current_partition += 1;
-      }
-    }
+  String ssid = ConfigurationManager::get_legacy_string("wifi-ssid");
+  String pass = ConfigurationManager::get_legacy_string("wifi-pass");
+  if(!ssid.isEmpty() && ssid.length() < CONFIG_WIFI_SSID_SIZE && pass.length() < CONFIG_WIFI_PASS_SIZE) {
+    memcpy(config.wifi_ssid, ssid.c_str(), ssid.length() + 1);
+    memcpy(config.wifi_pass, pass.c_str(), pass.length() + 1);
+    found = true;
+  }
 
-    if(current_value != "") {
-      String key_partition = String(key) + "-" + String(current_partition);
-      preferences.putString(key_partition.c_str(), current_value);
-      Serial.printf("Partition Part-%d Info: %s\n", current_partition, current_value);
-      current_partition += 1;
+  for(uint8_t sensor_index = 0; sensor_index < CONFIG_MAX_SENSORS; sensor_index++) {
+    String key = "cal-" + String(sensor_index);
+    if(!preferences.isKey(key.c_str())) continue;
+
+    CalibrationCurve curve;
+    if(preferences.getBytes(key.c_str(), &curve, sizeof(CalibrationCurve)) == sizeof(CalibrationCurve) && curve.is_valid()) {
+      config.calibrations[sensor_index] = curve;
+      found = true;
     }
+  }
+
+  preferences.end();
+
+  if(!found || !ConfigurationManager::save()) return false;
 
-    String key_ps = "ps-" + String(key);
-    preferences.putShort(key_ps.c_str(), current_partition);
+  // Only once the blob is saved, the old keys are the only copy until then
+  preferences.begin(CONFIG_NAMESPACE, false);
+  ConfigurationManager::remove_legacy_string("wifi-ssid");
+  ConfigurationManager::remove_legacy_string("wifi-pass");
+  for(uint8_t sensor_index = 0; sensor_index < CONFIG_MAX_SENSORS; sensor_index++) {
+    preferences.remove(("cal-" + String(sensor_index)).c_str());
   }
-  
   preferences.end();
+
+  return true;
 }
 
-String ConfigurationManager::get_string(const char* key) {
-  // Check if there's partition for it
+String ConfigurationManager::get_legacy_string(const char* key) {
+  // Values of 10 characters or more were split into "<key>-<N>" parts, counted in "ps-<key>"
   String key_ps = "ps-" + String(key);
   uint16_t partition_size_info = preferences.getShort(key_ps.c_str(), 0);
-  Serial.printf("Partition Size Info: %d\n", partition_size_info);
 
   // If there's no partition
   if(partition_size_info == 0) {
@@ -304,14 +337,95 @@ String ConfigurationManager::get_string(const char* key) {
   }
 
   // If there's partition
-  else {
-    String result = "";
-    for(uint16_t partition_index = 0; partition_index < partition_size_info; partition_index++) {
-      String key_partition = String(key) + "-" + String(partition_index);
-      result += preferences.getString(key_partition.c_str(), "");
-    }
-    return result;
+  String result = "";
+  for(uint16_t partition_index = 0; partition_index < partition_size_info; partition_index++) {
+    String key_partition = String(key) + "-" + String(partition_index);
+    result += preferences.getString(key_partition.c_str(), "");
   }
+  return result;
+}
+
+void ConfigurationManager::remove_legacy_string(const char* key) {
+  String key_ps = "ps-" + String(key);
+  uint16_t partition_size_info = preferences.getShort(key_ps.c_str(), 0);
+
+  for(uint16_t partition_index = 0; partition_index < partition_size_info; partition_index++) {
+    String key_partition = String(key) + "-" + String(partition_index);
+    preferences.remove(key_partition.c_str());
+  }
+
+  preferences.remove(key_ps.c_str());
+  preferences.remove(key);
+}
+
+
+
+//? Readers and Writers
+void ConfigurationManager::get_wifi_creds(String &ssid_container, String &pass_container) {
+  ssid_container = ConfigurationManager::config.wifi_ssid;
+  pass_container = ConfigurationManager::config.wifi_pass;
+}
+
+
+
+void ConfigurationManager::set_wifi_ssid(String &new_ssid) {
+  if(new_ssid.length() >= CONFIG_WIFI_SSID_SIZE) {
+    #ifdef SHOW_WARN
+    Serial.println("[Configuration] WiFi SSID is too long, it's not saved!");
+    #endif
+    return;
+  }
+
+  #ifdef SHOW_INFO
+  Serial.println("[Configuration] Saving new WiFi SSID...");
+  #endif
+  
+  memcpy(ConfigurationManager::config.wifi_ssid, new_ssid.c_str(), new_ssid.length() + 1);
+  if(!ConfigurationManager::save()) return;
+
+  #ifdef SHOW_INFO
+  Serial.println("[Configuration] New WiFi SSID saved!");
+  #endif
+}
+
+void ConfigurationManager::set_wifi_pass(String &new_pass) {
+  if(new_pass.length() >= CONFIG_WIFI_PASS_SIZE) {
+    #ifdef SHOW_WARN
+    Serial.println("[Configuration] WiFi password is too long, it's not saved!");
+    #endif
+    return;
+  }
+
+  #ifdef SHOW_INFO
+  Serial.println("[Configuration] Saving new WiFi password...");
+  #endif
+
+  memcpy(ConfigurationManager::config.wifi_pass, new_pass.c_str(), new_pass.length() + 1);
+  if(!ConfigurationManager::save()) return;
+
+  #ifdef SHOW_INFO
+  Serial.println("[Configuration] New WiFi password saved!");
+  #endif
+}
+
+bool ConfigurationManager::get_calibration(uint8_t sensor_index, CalibrationCurve &curve) {
+  if(sensor_index >= CONFIG_MAX_SENSORS) return false;
+
+  curve = ConfigurationManager::config.calibrations[sensor_index];
+  return curve.is_valid();
+}
+
+bool ConfigurationManager::set_calibration(uint8_t sensor_index, const CalibrationCurve &curve) {
+  if(sensor_index >= CONFIG_MAX_SENSORS || !curve.is_valid()) return false;
+
+  ConfigurationManager::config.calibrations[sensor_index] = curve;
+  if(!ConfigurationManager::save()) return false;
+
+  #ifdef SHOW_INFO
+  Serial.printf("[Configuration] Calibration for sensor #%d saved!\n", sensor_index);
+  #endif
+
+  return true;
 }
 
 void ConfigurationManager::set_wifi_log(const char *data) {
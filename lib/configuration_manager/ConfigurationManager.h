@@ -1,6 +1,46 @@
 #pragma once
 
 #include <Arduino.h>
+#include <CalibrationCurve.h>
+
+// Persistence storage namespace and the key of the configuration blob in it
+#define CONFIG_NAMESPACE "wms-dev"
+#define CONFIG_BLOB_KEY "config"
+
+// Bumped whenever DeviceConfig changes, a blob of another version is replaced by the defaults
+#define CONFIG_VERSION 1
+
+// Sensors the configuration has room for
+#define CONFIG_MAX_SENSORS 4
+
+// Text fields with their terminator (SSID is up to 32 characters, WPA2 passphrase up to 64)
+#define CONFIG_WIFI_SSID_SIZE 33
+#define CONFIG_WIFI_PASS_SIZE 65
+#define CONFIG_SERVER_ADDRESS_SIZE 64
+
+// Pin left to the build-time wiring
+#define CONFIG_PIN_UNSET 0xFF
+
+/**
+ * @brief Everything the device keeps across reboots, stored as a single CRC-checked blob
+ * @note Zero (or an empty string, or CONFIG_PIN_UNSET) means the build-time default is used
+ */
+struct DeviceConfig
+{
+  uint16_t version;
+  uint16_t size;                    // sizeof(DeviceConfig), catches a layout change that kept the version
+  char wifi_ssid[CONFIG_WIFI_SSID_SIZE];
+  char wifi_pass[CONFIG_WIFI_PASS_SIZE];
+  char server_address[CONFIG_SERVER_ADDRESS_SIZE];
+  uint16_t server_port;
+  uint32_t report_interval_ms;      // Heartbeat, the longest time between two snapshots
+  uint32_t false_alarm_samples;     // Leak detection sensitivity
+  uint32_t noise_floor_mlpm;
+  uint8_t sensor_pins[CONFIG_MAX_SENSORS];
+  uint8_t buzzer_pins[CONFIG_MAX_SENSORS];
+  CalibrationCurve calibrations[CONFIG_MAX_SENSORS]; // Size 0 is the build-time table
+  uint32_t crc;                     // CRC-32 of everything before it
+};
 
 // Class definition
 class ConfigurationManager
@@ -10,6 +50,32 @@ public:
   static bool is_ble_active;
   static String data_chunked;
 
+  /**
+   * @brief Used to load the configuration from persistence storage into RAM
+   * @note Call this once at boot before reading anything, every reader after it is a memory read
+   * @note Values saved by older firmware (chunked strings, "cal-N" curves) are moved into the blob once
+   * @return false if there was no valid configuration and the defaults are used
+   * 
+   */
+  static bool begin();
+
+  /**
+   * @brief Used to get the configuration loaded by begin()
+   * 
+   */
+  static const DeviceConfig &get_config();
+
+  /**
+   * @brief Used to replace the configuration and save it to persistence storage
+   * 
+   * @code
+   * DeviceConfig config = ConfigurationManager::get_config();
+   * config.report_interval_ms = 30000;
+   * ConfigurationManager::set_config(config);
+   * @endcode
+   */
+  static bool set_config(const DeviceConfig &config);
+
   /**
    * @brief Used to start configuration process including BLE server setup
    * @note You could put this if you want to go configuration mode
@@ -28,7 +94,7 @@ public:
 
   
   /**
-   * @brief Used to get WiFi SSID and PASSWORD from persistance storage
+   * @brief Used to get WiFi SSID and PASSWORD from the loaded configuration
    * @param ssid_container Used to contain WiFi SSID
    * @param pass_container Used to contain WiFi password
    * 
@@ -51,19 +117,22 @@ public:
    */
   static void set_wifi_pass(String &new_pass);
 
+
   /**
-   * @brief Used to set String to persistence storage
-   * @attention Use this after calling start_config_mode() function
+   * @brief Used to get calibration curve of a flow sensor from the loaded configuration
+   * @param sensor_index the sensor in the order it was added
+   * @param curve Used to contain the calibration curve
+   * @return true if there's a valid curve stored for the sensor
    * 
    */
-  static void set_string(const char *key, String &value);
+  static bool get_calibration(uint8_t sensor_index, CalibrationCurve &curve);
 
   /**
-   * @brief Used to get String from persistence storage
-   * @attention Use this after calling start_config_mode() function
+   * @brief Used to save calibration curve of a flow sensor to persistence storage
+   * @return false if the curve isn't valid
    * 
    */
-  static String get_string(const char *key);
+  static bool set_calibration(uint8_t sensor_index, const CalibrationCurve &curve);
 
 
   /**
@@ -72,4 +141,14 @@ public:
    * 
    */
   static void set_wifi_log(const char *data);
+
+private:
+  static DeviceConfig config;
+
+  static void load_defaults();
+  static bool save();
+  static bool migrate_legacy_keys();
+  static String get_legacy_string(const char *key);
+  static void remove_legacy_string(const char *key);
+  static uint32_t get_crc(const DeviceConfig &config);
 };
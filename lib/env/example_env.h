@@ -8,4 +8,14 @@
 // Uncomment these if you want to get yelled by Serial.print
 // #define SHOW_DEBUG
 // #define SHOW_INFO
-// #define SHOW_WARN
\ No newline at end of file
+// #define SHOW_WARN
+
+// Uncomment this to count flow sensor pulses with the PCNT peripheral instead of GPIO interrupts
+// #define FLOW_SENSOR_USE_PCNT
+
+// POSIX timezone of the device, used for the night flow window (defaults to UTC)
+// #define ENV_TIMEZONE "WIB-7"
+// Uncomment this to send telemetry as binary frames (TelemetryFrame) instead of "key=value" text
+// #define ENV_BINARY_TELEMETRY
+// Uncomment this to upload the offline telemetry log delta compressed (HistoryCodec)
+// #define ENV_COMPRESSED_TELEMETRY_LOG
@@ -0,0 +1,114 @@
+#include <FlowHistory.h>
+
+FlowHistory::FlowHistory() {
+  this->rings[FLOW_HISTORY_TIER_RAW] = {this->raw_entries, FLOW_HISTORY_RAW_SIZE, 0, 0, 0, FLOW_HISTORY_RAW_SECONDS};
+  this->rings[FLOW_HISTORY_TIER_MINUTE] = {this->minute_entries, FLOW_HISTORY_MINUTE_SIZE, 0, 0, 0, FLOW_HISTORY_MINUTE_SECONDS};
+  this->rings[FLOW_HISTORY_TIER_HOUR] = {this->hour_entries, FLOW_HISTORY_HOUR_SIZE, 0, 0, 0, FLOW_HISTORY_HOUR_SECONDS};
+}
+
+void FlowHistory::add_sample(uint32_t time_s, uint32_t flow_mlpm) {
+  uint32_t value = flow_mlpm / FLOW_HISTORY_UNIT_MLPM;
+  if(value >= FLOW_HISTORY_NO_DATA) value = FLOW_HISTORY_NO_DATA - 1;
+
+  Entry entry = {(uint16_t) value, (uint16_t) value, (uint16_t) value};
+  FlowHistory::push(this->rings[FLOW_HISTORY_TIER_RAW], time_s / FLOW_HISTORY_RAW_SECONDS, entry);
+
+  // Minute is over, write it and roll it into the hour
+  uint32_t minute_slot = time_s / FLOW_HISTORY_MINUTE_SECONDS;
+  if(this->minute_accumulator.samples > 0 && minute_slot != this->minute_accumulator.slot) {
+    const Accumulator &minute = this->minute_accumulator;
+    FlowHistory::push(this->rings[FLOW_HISTORY_TIER_MINUTE], minute.slot, FlowHistory::close(minute));
+
+    // Hour is over, write it
+    uint32_t hour_slot = minute.slot * FLOW_HISTORY_MINUTE_SECONDS / FLOW_HISTORY_HOUR_SECONDS;
+    if(this->hour_accumulator.samples > 0 && hour_slot != this->hour_accumulator.slot) {
+      FlowHistory::push(this->rings[FLOW_HISTORY_TIER_HOUR], this->hour_accumulator.slot, FlowHistory::close(this->hour_accumulator));
+      this->hour_accumulator.samples = 0;
+    }
+    this->hour_accumulator.slot = hour_slot;
+    FlowHistory::accumulate(this->hour_accumulator, minute.min, minute.max, minute.sum, minute.samples);
+
+    this->minute_accumulator.samples = 0;
+  }
+
+  this->minute_accumulator.slot = minute_slot;
+  FlowHistory::accumulate(this->minute_accumulator, value, value, value, 1);
+}
+
+uint16_t FlowHistory::query(FlowHistoryTier tier, uint32_t from_s, uint32_t to_s, FlowAggregate *points, uint16_t max_points) const {
+  if(tier >= FLOW_HISTORY_TIER_COUNT) return 0;
+
+  const Ring &ring = this->rings[tier];
+  if(ring.count == 0 || from_s > to_s) return 0;
+
+  // Clamp the range to what the ring still holds
+  uint32_t oldest_slot = ring.newest_slot - (ring.count - 1);
+  uint32_t from_slot = from_s / ring.slot_seconds;
+  uint32_t to_slot = to_s / ring.slot_seconds;
+  if(from_slot < oldest_slot) from_slot = oldest_slot;
+  if(to_slot > ring.newest_slot) to_slot = ring.newest_slot;
+  if(from_slot > to_slot) return 0;
+
+  // Jump straight to the first slot
+  uint16_t index = (ring.head + ring.capacity - 1 - (ring.newest_slot - from_slot)) % ring.capacity;
+
+  uint16_t count = 0;
+  for(uint32_t slot = from_slot; slot <= to_slot && count < max_points; slot++) {
+    const Entry &entry = ring.entries[index];
+    index = (index + 1) % ring.capacity;
+
+    if(entry.avg == FLOW_HISTORY_NO_DATA) continue;
+
+    points[count].time_s = slot * ring.slot_seconds;
+    points[count].min_mlpm = entry.min * FLOW_HISTORY_UNIT_MLPM;
+    points[count].max_mlpm = entry.max * FLOW_HISTORY_UNIT_MLPM;
+    points[count].avg_mlpm = entry.avg * FLOW_HISTORY_UNIT_MLPM;
+    count++;
+  }
+
+  return count;
+}
+
+void FlowHistory::push(Ring &ring, uint32_t slot, const Entry &entry) {
+  if(ring.count > 0) {
+    // Same slot again, keep the latest value
+    if(slot == ring.newest_slot) {
+      ring.entries[(ring.head + ring.capacity - 1) % ring.capacity] = entry;
+      return;
+    }
+
+    // Time can't go backwards, compared by difference so it holds across a wrap of the slot number
+    if((int32_t) (slot - ring.newest_slot) < 0) return;
+
+    // Mark slots without samples, no need to mark more than the whole ring
+    uint32_t gap = slot - ring.newest_slot - 1;
+    if(gap > ring.capacity) gap = ring.capacity;
+    for(uint32_t index = 0; index < gap; index++) {
+      ring.entries[ring.head] = {FLOW_HISTORY_NO_DATA, FLOW_HISTORY_NO_DATA, FLOW_HISTORY_NO_DATA};
+      ring.head = (ring.head + 1) % ring.capacity;
+      if(ring.count < ring.capacity) ring.count++;
+    }
+  }
+
+  ring.entries[ring.head] = entry;
+  ring.head = (ring.head + 1) % ring.capacity;
+  if(ring.count < ring.capacity) ring.count++;
+  ring.newest_slot = slot;
+}
+
+void FlowHistory::accumulate(Accumulator &accumulator, uint16_t min, uint16_t max, uint32_t sum, uint32_t samples) {
+  if(accumulator.samples == 0) {
+    accumulator.min = min;
+    accumulator.max = max;
+    accumulator.sum = 0;
+  }
+
+  if(min < accumulator.min) accumulator.min = min;
+  if(max > accumulator.max) accumulator.max = max;
+  accumulator.sum += sum;
+  accumulator.samples += samples;
+}
+
+FlowHistory::Entry FlowHistory::close(const Accumulator &accumulator) {
+  return {accumulator.min, accumulator.max, (uint16_t) (accumulator.sum / accumulator.samples)};
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Raw tier, one sample per second for the last 5 minutes
+#define FLOW_HISTORY_RAW_SIZE 300
+#define FLOW_HISTORY_RAW_SECONDS 1
+
+// Minute tier, min / max / average per minute for the last day
+#define FLOW_HISTORY_MINUTE_SIZE 1440
+#define FLOW_HISTORY_MINUTE_SECONDS 60
+
+// Hour tier, min / max / average per hour for the last 30 days
+#define FLOW_HISTORY_HOUR_SIZE 720
+#define FLOW_HISTORY_HOUR_SECONDS 3600
+
+// Values are stored in 10 mL/min steps, this one marks a slot without samples
+#define FLOW_HISTORY_UNIT_MLPM 10
+#define FLOW_HISTORY_NO_DATA 0xFFFF
+
+enum FlowHistoryTier : uint8_t
+{
+  FLOW_HISTORY_TIER_RAW = 0,
+  FLOW_HISTORY_TIER_MINUTE,
+  FLOW_HISTORY_TIER_HOUR,
+  FLOW_HISTORY_TIER_COUNT,
+};
+
+/**
+ * @brief One point of a history query
+ */
+struct FlowAggregate
+{
+  uint32_t time_s;      // Start of the slot in seconds
+  uint32_t min_mlpm;
+  uint32_t max_mlpm;
+  uint32_t avg_mlpm;
+};
+
+/**
+ * @brief Fixed memory flow history of one sensor with downsampling tiers
+ * @details Every sample goes into the raw tier and into running minute and hour aggregates.
+ *          An aggregate is written to its tier when its slot is over, so each sample costs O(1).
+ *          Memory is fixed, ~15 KB per sensor with the default sizes.
+ * 
+ * example usage:
+ * @code
+ * FlowHistory flow_history;
+ * 
+ * void loop() {
+ *  if(water_leakage_guard.run()) {
+ *    flow_history.add_sample(esp_timer_get_time() / 1000000, water_leakage_guard.get_flow_rate_mlpm(0));
+ *  }
+ * }
+ * 
+ * // Every minute of the last hour
+ * FlowAggregate points[60];
+ * uint16_t count = flow_history.query(FLOW_HISTORY_TIER_MINUTE, now - 3600, now, points, 60);
+ * @endcode
+ */
+class FlowHistory
+{
+public:
+  FlowHistory();
+
+  /**
+   * @brief Used to add one flow sample
+   * @param time_s sample time in seconds, must not go backwards
+   * @param flow_mlpm flow in millilitres per minute
+   */
+  void add_sample(uint32_t time_s, uint32_t flow_mlpm);
+
+  /**
+   * @brief Used to read a time range from a tier, oldest first
+   * @param from_s start of the range in seconds (included)
+   * @param to_s end of the range in seconds (included)
+   * @param points is filled with one point per slot that has samples
+   * @return number of points written
+   */
+  uint16_t query(FlowHistoryTier tier, uint32_t from_s, uint32_t to_s, FlowAggregate *points, uint16_t max_points) const;
+
+private:
+  struct Entry
+  {
+    uint16_t min;
+    uint16_t max;
+    uint16_t avg;
+  };
+
+  struct Ring
+  {
+    Entry *entries;
+    uint16_t capacity;
+    uint16_t head;            // Next slot to write
+    uint16_t count;
+    uint32_t newest_slot;     // Slot number (time / slot seconds) of the newest entry
+    uint32_t slot_seconds;
+  };
+
+  struct Accumulator
+  {
+    uint32_t slot;
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+    uint32_t samples;
+  };
+
+  Entry raw_entries[FLOW_HISTORY_RAW_SIZE];
+  Entry minute_entries[FLOW_HISTORY_MINUTE_SIZE];
+  Entry hour_entries[FLOW_HISTORY_HOUR_SIZE];
+  Ring rings[FLOW_HISTORY_TIER_COUNT];
+
+  Accumulator minute_accumulator = {};
+  Accumulator hour_accumulator = {};
+
+  static void push(Ring &ring, uint32_t slot, const Entry &entry);
+  static void accumulate(Accumulator &accumulator, uint16_t min, uint16_t max, uint32_t sum, uint32_t samples);
+  static Entry close(const Accumulator &accumulator);
+};
@@ -0,0 +1,46 @@
+#include <CalibrationCurve.h>
+
+bool CalibrationCurve::is_valid() const {
+  if(this->size < 2 || this->size > CALIBRATION_CURVE_MAX_POINTS) return false;
+
+  for(uint8_t i = 1; i < this->size; i++) {
+    if(this->points[i].frequency_mhz <= this->points[i - 1].frequency_mhz) return false;
+  }
+
+  return true;
+}
+
+uint32_t CalibrationCurve::evaluate(uint32_t frequency_mhz) const {
+  return this->evaluate_ulpm(frequency_mhz) / 1000;
+}
+
+uint32_t CalibrationCurve::evaluate_ulpm(uint32_t frequency_mhz) const {
+  // Find the segment by counting inner points below the frequency, no early exit
+  uint8_t index = 0;
+  for(uint8_t i = 1; i + 1 < this->size; i++) {
+    index += (frequency_mhz >= this->points[i].frequency_mhz);
+  }
+
+  const CalibrationPoint &start = this->points[index];
+  const CalibrationPoint &end = this->points[index + 1];
+
+  int64_t flow = (int64_t) start.flow_mlpm * 1000 +
+                 ((int64_t) frequency_mhz - start.frequency_mhz) * ((int64_t) end.flow_mlpm - start.flow_mlpm) * 1000 /
+                 ((int64_t) end.frequency_mhz - start.frequency_mhz);
+
+  return flow < 0 ? 0 : (uint32_t) flow;
+}
+
+bool CalibrationCurve::get_pulses_per_kilolitre(uint32_t &pulses_per_kilolitre) const {
+  const CalibrationPoint &last = this->points[this->size - 1];
+  if(last.frequency_mhz == 0 || last.flow_mlpm == 0) return false;
+
+  // Every point on the line from zero to the last one
+  for(uint8_t i = 0; i + 1 < this->size; i++) {
+    if((uint64_t) this->points[i].flow_mlpm * last.frequency_mhz != (uint64_t) this->points[i].frequency_mhz * last.flow_mlpm) return false;
+  }
+
+  // mHz * 60 s/min / 1000 mHz/Hz pulses per minute for flow mL, times 1000000 mL per kL
+  pulses_per_kilolitre = (uint32_t) (((uint64_t) last.frequency_mhz * 60000ULL + last.flow_mlpm / 2) / last.flow_mlpm);
+  return pulses_per_kilolitre != 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define CALIBRATION_CURVE_MAX_POINTS 8
+
+/**
+ * @brief One measured point of a flow sensor, pulse frequency against real flow
+ */
+struct CalibrationPoint
+{
+  uint32_t frequency_mhz; // Pulse frequency in millihertz
+  uint32_t flow_mlpm;     // Flow in millilitres per minute at that frequency
+};
+
+/**
+ * @brief Piecewise-linear calibration curve, frequency -> flow
+ * @note Points must be sorted by frequency, flow outside the first / last point is extrapolated
+ * @note It's a plain aggregate so it can be a constexpr table or a blob in persistence storage
+ * 
+ * example usage:
+ * @code
+ * constexpr CalibrationCurve MY_SENSOR_CURVE = {{
+ *   {0, 0},
+ *   {5000, 800},     // 5 Hz  -> 0.8 L/min
+ *   {30000, 4100},   // 30 Hz -> 4.1 L/min
+ *   {75000, 10300},  // 75 Hz -> 10.3 L/min
+ * }, 4};
+ * 
+ * water_leakage_guard.set_calibration(0, MY_SENSOR_CURVE);
+ * @endcode
+ */
+struct CalibrationCurve
+{
+  CalibrationPoint points[CALIBRATION_CURVE_MAX_POINTS];
+  uint8_t size;
+
+  /**
+   * @brief Check if the curve can be used (2 points or more, sorted by frequency)
+   */
+  bool is_valid() const;
+
+  /**
+   * @brief Get flow in millilitres per minute for a pulse frequency in millihertz
+   */
+  uint32_t evaluate(uint32_t frequency_mhz) const;
+
+  /**
+   * @brief Same as evaluate(), in microlitres per minute
+   */
+  uint32_t evaluate_ulpm(uint32_t frequency_mhz) const;
+
+  /**
+   * @brief Check if flow is proportional to frequency (a straight line through zero), like a single calibration factor
+   * @param pulses_per_kilolitre is filled with the pulses per 1000 litres of that line
+   */
+  bool get_pulses_per_kilolitre(uint32_t &pulses_per_kilolitre) const;
+};
+
+// Nominal YF-S201 curve from the datasheet (F = 7.5 * Q), replace it with measured points per sensor
+constexpr CalibrationCurve YF_S201_CALIBRATION = {{
+  {0, 0},
+  {75000, 10000},
+}, 2};
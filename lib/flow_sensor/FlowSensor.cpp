@@ -2,28 +2,24 @@
 #include <Arduino.h>
 #include <env.h>
 
-portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED; //? Used to get the KEY to LOCK the freaking VOLATILE CHANGES happening in all of the program
 
+FlowSensor::FlowSensor(uint8_t sensor_pin, uint8_t buzzer_pin, float calibration_factor, PulseCounter *counter) {
+  this->begin(sensor_pin, buzzer_pin, calibration_factor, counter);
+}
 
-FlowSensor::FlowSensor(uint8_t sensor_pin, uint8_t buzzer_pin, float calibration_factor) {
+void FlowSensor::begin(uint8_t sensor_pin, uint8_t buzzer_pin, float calibration_factor, PulseCounter *counter) {
   this->sensor_pin = sensor_pin;
   this->buzzer_pin = buzzer_pin;
-  this->calibration_factor = calibration_factor;
+  this->pulses_per_kilolitre = (uint32_t) (calibration_factor * 60.0f * 1000.0f + 0.5f); // Hz per L/min -> pulses per 1000 litres
+  this->counter = counter;
 
   pinMode(buzzer_pin, OUTPUT);
-  pinMode(sensor_pin, INPUT_PULLUP);
-
-  attachInterruptArg(digitalPinToInterrupt(sensor_pin), this->isrRouter, this, FALLING);
-}
 
-//? Interruption handlers
-void IRAM_ATTR FlowSensor::handlePulse() {
-  this->pulse_count++;
-}
-
-void FlowSensor::isrRouter(void* arg) {
-  FlowSensor* self = static_cast<FlowSensor*>(arg);
-  self->handlePulse();
+  if(!this->counter->begin()) {
+    #ifdef SHOW_WARN
+    Serial.printf("[FlowSensor] Failed to start pulse counter for pin %d\n", sensor_pin);
+    #endif
+  }
 }
 
 //? Flow Rate and Total litres Calculation
@@ -32,28 +28,137 @@ void FlowSensor::update() {
   uint64_t elapsed = current_time - this->last_time;
 
   if (elapsed >= 1000) {  // updates every seconds
-    detachInterrupt(digitalPinToInterrupt(this->sensor_pin));
-    uint32_t count = this->pulse_count;
-    this->pulse_count = 0;
+    this->update(this->counter->take(), elapsed);
+    this->last_time = current_time;
+  }
 
-    float frequency = (1000.0 / elapsed) * count;
-    this->flow_rate = frequency / this->calibration_factor;
-    this->total_litres += (this->flow_rate / 60.0f) * (elapsed / 1000.0f);
+  this->refresh();
+}
 
-    this->last_time = current_time;
-    attachInterruptArg(digitalPinToInterrupt(this->sensor_pin), this->isrRouter, this, FALLING);
+void FlowSensor::update(uint32_t count, uint32_t elapsed_ms) {
+  if(elapsed_ms == 0) return;
+
+  this->total_pulses += count;
+
+  uint32_t frequency_mhz = (uint32_t) ((uint64_t) count * 1000000ULL / elapsed_ms);
+  uint32_t flow_ulpm = this->frequency_to_flow_ulpm(frequency_mhz);
+  this->flow_rate_mlpm = flow_ulpm / 1000;
+
+  // Non-linear curves integrate in microlitres and carry what's left, so nothing is truncated per window
+  if(!this->volume_from_pulses) {
+    uint64_t volume = (uint64_t) flow_ulpm * elapsed_ms + this->integration_remainder;
+    this->integrated_microlitres += volume / 60000ULL;
+    this->integration_remainder = volume % 60000ULL;
+  }
+
+  this->last_period_time = 0; // Let the period refine this window right away
+}
+
+void FlowSensor::refresh() {
+  uint64_t current_time = millis();
+
+  // At low flow there are too few pulses per window, use the time between pulses instead
+  if (current_time - this->last_period_time >= FLOW_SENSOR_PERIOD_UPDATE_MS) {
+    this->update_from_period();
+    this->last_period_time = current_time;
+  }
+}
+
+void FlowSensor::update_from_period() {
+  uint32_t period_us = 0;
+  uint32_t last_pulse_us = 0;
+  if(!this->counter->get_pulse_timing(period_us, last_pulse_us)) return;
+
+  // Fast enough for the pulse count to be accurate
+  if(period_us < FLOW_SENSOR_PERIOD_MODE_MIN_US) return;
+
+  uint32_t since_last_pulse = micros() - last_pulse_us;
+
+  // No pulse for a long time, the water stopped
+  if(since_last_pulse > FLOW_SENSOR_PERIOD_TIMEOUT_US) {
+    this->flow_rate_mlpm = 0;
+    return;
   }
+
+  // Next pulse is late, so the flow is at most one pulse per elapsed time
+  if(since_last_pulse > period_us) period_us = since_last_pulse;
+
+  uint32_t frequency_mhz = (uint32_t) (1000000000ULL / period_us);
+  this->flow_rate_mlpm = this->frequency_to_flow_ulpm(frequency_mhz) / 1000;
+}
+
+uint32_t FlowSensor::frequency_to_flow_ulpm(uint32_t frequency_mhz) const {
+  if(this->curve.size != 0) return this->curve.evaluate_ulpm(frequency_mhz);
+
+  // mHz * 60 s/min * 1000 L/kL / (pulses/kL) * 1000000 uL/L / 1000 mHz/Hz
+  return (uint32_t) ((uint64_t) frequency_mhz * 60000000ULL / this->pulses_per_kilolitre);
+}
+
+// Start counting volume again from the current total
+void FlowSensor::rebase_volume() {
+  this->volume_base_millilitres = this->get_total_millilitres();
+  this->volume_base_pulses = this->total_pulses;
+  this->integrated_microlitres = 0;
+  this->integration_remainder = 0;
 }
 
 
 
 //? Getter Setter
 float FlowSensor::get_flow_rate() const {
-  return this->flow_rate;
+  return this->flow_rate_mlpm / 1000.0f;
 }
 
 float FlowSensor::get_total_litres() const {
-  return this->total_litres;
+  return this->get_total_millilitres() / 1000.0f;
+}
+
+PulseCounter *FlowSensor::get_counter() const {
+  return this->counter;
+}
+
+bool FlowSensor::set_calibration(const CalibrationCurve &curve) {
+  if(!curve.is_valid()) {
+    #ifdef SHOW_WARN
+    Serial.printf("[FlowSensor] Invalid calibration curve for pin %d\n", this->sensor_pin);
+    #endif
+    return false;
+  }
+
+  // Keep the volume counted so far with the old calibration
+  this->rebase_volume();
+  this->curve = curve;
+
+  // A straight line through zero is a single calibration factor, the pulse total stays exact
+  uint32_t pulses_per_kilolitre = 0;
+  this->volume_from_pulses = curve.get_pulses_per_kilolitre(pulses_per_kilolitre);
+  if(this->volume_from_pulses) this->pulses_per_kilolitre = pulses_per_kilolitre;
+
+  return true;
+}
+
+uint32_t FlowSensor::get_flow_rate_mlpm() const {
+  return this->flow_rate_mlpm;
+}
+
+uint64_t FlowSensor::get_total_pulses() const {
+  return this->total_pulses;
+}
+
+uint64_t FlowSensor::get_total_millilitres() const {
+  // Non-linear sensors can't derive volume from pulses alone
+  if(!this->volume_from_pulses) return this->volume_base_millilitres + this->integrated_microlitres / 1000ULL;
+
+  return this->volume_base_millilitres + (this->total_pulses - this->volume_base_pulses) * 1000000ULL / this->pulses_per_kilolitre;
+}
+
+
+void FlowSensor::restore_totals(uint64_t total_pulses, uint64_t total_millilitres) {
+  this->total_pulses = total_pulses;
+  this->volume_base_millilitres = total_millilitres;
+  this->volume_base_pulses = total_pulses;
+  this->integrated_microlitres = 0;
+  this->integration_remainder = 0;
 }
 
 
@@ -2,30 +2,133 @@
 
 #include <Arduino.h>
 #include <vector>
+#include <PulseCounter.h>
+#include <CalibrationCurve.h>
+
+// Default calibration for YF-S201 style sensors, pulse frequency (Hz) per L/min
+#define FLOW_SENSOR_DEFAULT_CALIBRATION_FACTOR 7.5
+
+// How often the flow rate is refreshed from the pulse period
+#define FLOW_SENSOR_PERIOD_UPDATE_MS 100
+
+// Pulses slower than this period (10 Hz) use period based flow instead of the pulse count
+#define FLOW_SENSOR_PERIOD_MODE_MIN_US 100000UL
+
+// No pulse for this long means there's no flow at all
+#define FLOW_SENSOR_PERIOD_TIMEOUT_US 5000000UL
 
 class FlowSensor
 {
 public:
-  uint8_t sensor_pin;
-  uint8_t buzzer_pin;
-  uint8_t error;
+  uint8_t sensor_pin = 0;
+  uint8_t buzzer_pin = 0;
+  uint8_t error = 0;
   
-  void IRAM_ATTR handlePulse();
-  FlowSensor(uint8_t sensor_pin, uint8_t buzzer_pin, float calibration_factor);
+  /**
+   * @brief Create a flow sensor on top of a pulse counting backend
+   * @param counter backend that counts the sensor pulses, must outlive the sensor
+   * 
+   * example usage:
+   * @code
+   * InterruptPulseCounter counter(4);
+   * FlowSensor sensor(4, BUZZER_PIN, 7.5, &counter);
+   * @endcode
+   */
+  FlowSensor(uint8_t sensor_pin, uint8_t buzzer_pin, float calibration_factor, PulseCounter *counter);
 
+  /**
+   * @brief Create an empty sensor slot, begin() must be called before using it
+   * @note Used to keep sensors in fixed arrays
+   */
+  FlowSensor() = default;
+
+  /**
+   * @brief Start a sensor created by the empty constructor, same parameters as the constructor
+   */
+  void begin(uint8_t sensor_pin, uint8_t buzzer_pin, float calibration_factor, PulseCounter *counter);
+
+  /**
+   * @brief Get flow rate in litres per minute
+   */
   float get_flow_rate() const;
+
+  /**
+   * @brief Use a piecewise-linear calibration curve instead of the single calibration factor
+   * @note Volume keeps coming from the pulse total when the curve is a straight line through zero,
+   *       otherwise it's integrated from the calibrated flow
+   * @return false if the curve isn't valid, the sensor keeps its previous calibration
+   */
+  bool set_calibration(const CalibrationCurve &curve);
+
+  /**
+   * @brief Get total volume in litres
+   */
   float get_total_litres() const;
 
+  /**
+   * @brief Get flow rate in millilitres per minute
+   */
+  uint32_t get_flow_rate_mlpm() const;
+
+  /**
+   * @brief Get every pulse counted since the sensor started
+   */
+  uint64_t get_total_pulses() const;
+
+  /**
+   * @brief Get total volume in millilitres
+   */
+  uint64_t get_total_millilitres() const;
+
+  /**
+   * @brief Continue counting from saved totals (after reboot)
+   */
+  void restore_totals(uint64_t total_pulses, uint64_t total_millilitres);
+
+  /**
+   * @brief Used to update flow rate and total litres
+   * @note Flow rate comes from the pulse count every second, and from the time between pulses
+   *       every FLOW_SENSOR_PERIOD_UPDATE_MS when the flow is too slow for counting
+   */
   void update();
+
+  /**
+   * @brief Used to apply a pulse count window captured outside of the sensor
+   * @param count pulses taken from the counter in the window
+   * @param elapsed_ms length of the window
+   * @note Use this instead of update() when every sensor is sampled at the same instant
+   */
+  void update(uint32_t count, uint32_t elapsed_ms);
+
+  /**
+   * @brief Used to refine flow rate from the time between pulses
+   * @note Already done by update(), call it in a loop() when using update(count, elapsed_ms)
+   */
+  void refresh();
+
+  /**
+   * @brief Get the pulse counting backend of the sensor
+   */
+  PulseCounter *get_counter() const;
   void buzz(uint8_t value);
   
 private:
-  float calibration_factor;
+  uint32_t pulses_per_kilolitre = 1;
+  PulseCounter *counter = nullptr;
+
+  uint64_t last_time = 0;
+  uint64_t last_period_time = 0;
+  uint32_t flow_rate_mlpm = 0;
+  uint64_t total_pulses = 0;
 
-  volatile uint32_t pulse_count;
-  uint64_t last_time;
-  float flow_rate;
-  float total_litres;
+  CalibrationCurve curve = {};
+  bool volume_from_pulses = true;      // Proportional calibration, volume comes from the pulse total
+  uint64_t volume_base_millilitres = 0; // Volume before the last calibration change or restore
+  uint64_t volume_base_pulses = 0;
+  uint64_t integrated_microlitres = 0;  // Calibrated flow integrated since the base, non-linear curves only
+  uint32_t integration_remainder = 0;   // uL/min * ms left over, less than one microlitre
 
-  static void IRAM_ATTR isrRouter(void* arg);
-};
\ No newline at end of file
+  void update_from_period();
+  void rebase_volume();
+  uint32_t frequency_to_flow_ulpm(uint32_t frequency_mhz) const;
+};
@@ -0,0 +1,70 @@
+#include <InterruptPulseCounter.h>
+#include <Arduino.h>
+
+portMUX_TYPE pulse_counter_mux = portMUX_INITIALIZER_UNLOCKED; //? Used to get the KEY to LOCK the freaking VOLATILE CHANGES happening in all of the program
+
+
+InterruptPulseCounter::InterruptPulseCounter(uint8_t sensor_pin) {
+  this->sensor_pin = sensor_pin;
+}
+
+bool InterruptPulseCounter::begin() {
+  pinMode(this->sensor_pin, INPUT_PULLUP);
+  attachInterruptArg(digitalPinToInterrupt(this->sensor_pin), this->isrRouter, this, FALLING);
+  return true;
+}
+
+uint32_t InterruptPulseCounter::take() {
+  // Swap the counter out while the ISR keeps running, so no pulse is lost
+  portENTER_CRITICAL(&pulse_counter_mux);
+  uint32_t count = this->pulse_count;
+  this->pulse_count = 0;
+  portEXIT_CRITICAL(&pulse_counter_mux);
+
+  return count;
+}
+
+bool InterruptPulseCounter::get_pulse_timing(uint32_t &period_us, uint32_t &last_pulse_us) {
+  uint32_t timestamps[PULSE_TIMESTAMP_BUFFER_SIZE];
+
+  // Copy the ring buffer out, newest timestamp first
+  portENTER_CRITICAL(&pulse_counter_mux);
+  uint8_t count = this->timestamp_count;
+  uint8_t index = this->timestamp_head;
+  for(uint8_t i = 0; i < count; i++) {
+    index = (index - 1) & (PULSE_TIMESTAMP_BUFFER_SIZE - 1);
+    timestamps[i] = this->pulse_timestamps[index];
+  }
+  portEXIT_CRITICAL(&pulse_counter_mux);
+
+  if(count < 2) return false;
+
+  // Only use pulses close to the latest one, so an old burst doesn't drag the period
+  uint8_t oldest = 0;
+  while(oldest + 1 < count && timestamps[0] - timestamps[oldest + 1] <= PULSE_TIMESTAMP_MAX_SPAN_US) {
+    oldest++;
+  }
+
+  if(oldest == 0) return false;
+
+  period_us = (timestamps[0] - timestamps[oldest]) / oldest;
+  last_pulse_us = timestamps[0];
+  return true;
+}
+
+//? Interruption handlers
+void IRAM_ATTR InterruptPulseCounter::handlePulse() {
+  uint32_t now = micros();
+
+  portENTER_CRITICAL_ISR(&pulse_counter_mux);
+  this->pulse_count++;
+  this->pulse_timestamps[this->timestamp_head] = now;
+  this->timestamp_head = (this->timestamp_head + 1) & (PULSE_TIMESTAMP_BUFFER_SIZE - 1);
+  if(this->timestamp_count < PULSE_TIMESTAMP_BUFFER_SIZE) this->timestamp_count++;
+  portEXIT_CRITICAL_ISR(&pulse_counter_mux);
+}
+
+void InterruptPulseCounter::isrRouter(void* arg) {
+  InterruptPulseCounter* self = static_cast<InterruptPulseCounter*>(arg);
+  self->handlePulse();
+}
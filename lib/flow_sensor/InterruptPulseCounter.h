@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+#include <PulseCounter.h>
+
+// Number of pulse timestamps kept per sensor (power of two)
+#define PULSE_TIMESTAMP_BUFFER_SIZE 8
+
+// Timestamps older than this (relative to the latest pulse) are not used for the period
+#define PULSE_TIMESTAMP_MAX_SPAN_US 3000000UL
+
+/**
+ * @brief Pulse counter that takes one GPIO interrupt per pulse
+ * @note Works on every pin, but costs CPU time for every pulse
+ * @note Also keeps the timestamps of the latest pulses for period based flow measurement
+ * 
+ */
+class InterruptPulseCounter : public PulseCounter
+{
+public:
+  InterruptPulseCounter(uint8_t sensor_pin = 0);
+
+  bool begin() override;
+  uint32_t take() override;
+  bool get_pulse_timing(uint32_t &period_us, uint32_t &last_pulse_us) override;
+
+private:
+  uint8_t sensor_pin;
+  volatile uint32_t pulse_count = 0;
+
+  // Ring buffer of micros() timestamps, written by the ISR
+  volatile uint32_t pulse_timestamps[PULSE_TIMESTAMP_BUFFER_SIZE] = {};
+  volatile uint8_t timestamp_head = 0;
+  volatile uint8_t timestamp_count = 0;
+
+  void IRAM_ATTR handlePulse();
+  static void IRAM_ATTR isrRouter(void* arg);
+};
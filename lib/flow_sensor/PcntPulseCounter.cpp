@@ -0,0 +1,59 @@
+#include <PcntPulseCounter.h>
+#include <Arduino.h>
+#include <env.h>
+
+// The unit wraps back to 0 when reaching this limit
+#define PCNT_HIGH_LIMIT 32767
+
+
+PcntPulseCounter::PcntPulseCounter(uint8_t sensor_pin, pcnt_unit_t unit, uint16_t filter_ticks) {
+  this->sensor_pin = sensor_pin;
+  this->unit = unit;
+  this->filter_ticks = filter_ticks;
+}
+
+bool PcntPulseCounter::begin() {
+  pinMode(this->sensor_pin, INPUT_PULLUP);
+
+  pcnt_config_t config = {};
+  config.pulse_gpio_num = this->sensor_pin;
+  config.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+  config.channel = PCNT_CHANNEL_0;
+  config.unit = this->unit;
+  config.pos_mode = PCNT_COUNT_DIS; // Count on falling edge only, same as the interrupt backend
+  config.neg_mode = PCNT_COUNT_INC;
+  config.lctrl_mode = PCNT_MODE_KEEP;
+  config.hctrl_mode = PCNT_MODE_KEEP;
+  config.counter_h_lim = PCNT_HIGH_LIMIT;
+  config.counter_l_lim = 0;
+
+  if(pcnt_unit_config(&config) != ESP_OK) {
+    #ifdef SHOW_WARN
+    Serial.printf("[PulseCounter] Failed to configure PCNT unit %d\n", this->unit);
+    #endif
+    return false;
+  }
+
+  // Hardware glitch filter, pulses shorter than the filter are ignored
+  pcnt_set_filter_value(this->unit, this->filter_ticks);
+  pcnt_filter_enable(this->unit);
+
+  pcnt_counter_pause(this->unit);
+  pcnt_counter_clear(this->unit);
+  pcnt_counter_resume(this->unit);
+
+  this->last_value = 0;
+  return true;
+}
+
+uint32_t PcntPulseCounter::take() {
+  // The unit is never cleared (clearing would race with incoming pulses), take the difference instead
+  int16_t value = 0;
+  pcnt_get_counter_value(this->unit, &value);
+
+  int32_t delta = (int32_t) value - this->last_value;
+  if(delta < 0) delta += PCNT_HIGH_LIMIT;
+
+  this->last_value = value;
+  return (uint32_t) delta;
+}
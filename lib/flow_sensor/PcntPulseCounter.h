@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+#include <driver/pcnt.h>
+#include <PulseCounter.h>
+
+// Default glitch filter in APB clock ticks (80 MHz), 1023 ticks ~ 12.8us is the hardware maximum
+#define PCNT_DEFAULT_FILTER_TICKS 1023
+
+/**
+ * @brief Pulse counter backed by the ESP32 PCNT peripheral
+ * @note Counting is done in hardware and costs no CPU time per pulse
+ * @attention Every instance needs its own PCNT unit (PCNT_UNIT_0 .. PCNT_UNIT_7)
+ * @attention take() must be called at least every 32767 pulses
+ * 
+ * example usage:
+ * @code
+ * PcntPulseCounter counter(4, PCNT_UNIT_0); // Count pulses of the sensor in pin 4 with unit 0
+ * @endcode
+ */
+class PcntPulseCounter : public PulseCounter
+{
+public:
+  PcntPulseCounter(uint8_t sensor_pin = 0, pcnt_unit_t unit = PCNT_UNIT_0, uint16_t filter_ticks = PCNT_DEFAULT_FILTER_TICKS);
+
+  bool begin() override;
+  uint32_t take() override;
+
+private:
+  uint8_t sensor_pin;
+  pcnt_unit_t unit;
+  uint16_t filter_ticks;
+  int16_t last_value = 0;
+};
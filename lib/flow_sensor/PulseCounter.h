@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Lock shared by every pulse counter, hold it to read several counters at the same instant
+extern portMUX_TYPE pulse_counter_mux;
+
+/**
+ * @brief Common interface for every pulse counting backend used by FlowSensor
+ * @note A backend keeps counting on its own, FlowSensor only collects what has been counted
+ * 
+ * example usage:
+ * @code
+ * InterruptPulseCounter counter(4);  // Count pulses of the sensor in pin 4
+ * counter.begin();
+ * 
+ * void loop() {
+ *  uint32_t pulses = counter.take(); // Pulses since the previous take()
+ * }
+ * @endcode
+ */
+class PulseCounter
+{
+public:
+  virtual ~PulseCounter() = default;
+
+  /**
+   * @brief Start counting
+   * @return true if the backend is ready, otherwise false
+   */
+  virtual bool begin() = 0;
+
+  /**
+   * @brief Get the number of pulses counted since the previous call and reset it
+   * @note Counting never stops while this is called, so no pulse gets lost
+   */
+  virtual uint32_t take() = 0;
+
+  /**
+   * @brief Get the timing of the latest pulses
+   * @param period_us is filled with the average period between the latest pulses in microseconds
+   * @param last_pulse_us is filled with the micros() timestamp of the latest pulse
+   * @return false if the backend can't capture timestamps or there aren't enough recent pulses yet
+   */
+  virtual bool get_pulse_timing(uint32_t &period_us, uint32_t &last_pulse_us) { return false; }
+};
@@ -0,0 +1,30 @@
+#include <SimulatedPulseCounter.h>
+
+bool SimulatedPulseCounter::begin() {
+  this->pulse_count = 0;
+  return true;
+}
+
+uint32_t SimulatedPulseCounter::take() {
+  uint32_t count = this->pulse_count;
+  this->pulse_count = 0;
+  return count;
+}
+
+void SimulatedPulseCounter::inject(uint32_t pulses) {
+  this->pulse_count += pulses;
+}
+
+void SimulatedPulseCounter::inject(uint32_t pulses, uint32_t period_us) {
+  this->pulse_count += pulses;
+  this->period_us = period_us;
+  this->last_pulse_us = micros();
+}
+
+bool SimulatedPulseCounter::get_pulse_timing(uint32_t &period_us, uint32_t &last_pulse_us) {
+  if(this->period_us == 0) return false;
+
+  period_us = this->period_us;
+  last_pulse_us = this->last_pulse_us;
+  return true;
+}
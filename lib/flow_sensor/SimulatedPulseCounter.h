@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include <PulseCounter.h>
+
+/**
+ * @brief Pulse counter fed by software instead of a real sensor
+ * @note Used to exercise FlowSensor and WaterLeakageGuard without any hardware attached
+ * 
+ * example usage:
+ * @code
+ * SimulatedPulseCounter counter;
+ * FlowSensor sensor(0, BUZZER_PIN, 7.5, &counter);
+ * 
+ * counter.inject(75);  // 75 pulses in the next window -> 10 litres / minute
+ * sensor.update();
+ * @endcode
+ */
+class SimulatedPulseCounter : public PulseCounter
+{
+public:
+  bool begin() override;
+  uint32_t take() override;
+
+  /**
+   * @brief Add pulses as if the sensor produced them
+   */
+  void inject(uint32_t pulses);
+
+  /**
+   * @brief Add pulses spaced by a fixed period, the latest one happening now
+   */
+  void inject(uint32_t pulses, uint32_t period_us);
+
+  bool get_pulse_timing(uint32_t &period_us, uint32_t &last_pulse_us) override;
+
+private:
+  uint32_t pulse_count = 0;
+  uint32_t period_us = 0;
+  uint32_t last_pulse_us = 0;
+};
@@ -0,0 +1,248 @@
+#include <HistoryCodec.h>
+#include <string.h>
+
+// Tag of a run record, zig-zag(0) << 1 with the run bit set
+#define HISTORY_CODEC_RUN_TAG 1
+
+//? Varint helpers, 7 bits per byte with the high bit set on all but the last
+static size_t get_varint_size(uint64_t value) {
+  size_t size = 1;
+  while(value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+static size_t write_varint(uint8_t *buffer, uint64_t value) {
+  size_t size = 0;
+  while(value >= 0x80) {
+    buffer[size++] = (uint8_t) value | 0x80;
+    value >>= 7;
+  }
+  buffer[size++] = (uint8_t) value;
+  return size;
+}
+
+// Small negative and positive numbers both become small unsigned ones: 0, -1, 1, -2... -> 0, 1, 2, 3...
+static uint32_t zigzag(uint32_t value) {
+  return (value << 1) ^ (uint32_t) ((int32_t) value >> 31);
+}
+
+static uint32_t unzigzag(uint32_t value) {
+  return (value >> 1) ^ (0 - (value & 1));
+}
+
+
+//? Encoder
+bool HistoryEncoder::begin(uint8_t *buffer, size_t capacity, uint8_t channel_count, bool run_length) {
+  this->buffer = buffer;
+  this->capacity = capacity;
+  this->length = 0;
+  this->channel_count = channel_count;
+  this->run_length = run_length;
+  this->sample_count = 0;
+  this->run_count = 0;
+  this->previous_timestamp = 0;
+  this->previous_step = 0;
+  memset(this->previous_values, 0, sizeof(this->previous_values));
+  memset(this->previous_deltas, 0, sizeof(this->previous_deltas));
+
+  if(channel_count > HISTORY_CODEC_MAX_CHANNELS || capacity < HISTORY_CODEC_HEADER_SIZE) {
+    this->capacity = 0;
+    return false;
+  }
+
+  buffer[0] = HISTORY_CODEC_VERSION;
+  buffer[1] = channel_count;
+  buffer[2] = run_length ? HISTORY_CODEC_RUN_LENGTH : 0;
+  this->length = HISTORY_CODEC_HEADER_SIZE;
+
+  return true;
+}
+
+bool HistoryEncoder::add(uint32_t timestamp, const uint32_t *values) {
+  if(this->capacity == 0) return false;
+
+  uint8_t record[HISTORY_CODEC_MAX_RECORD_SIZE];
+  size_t record_size = 0;
+
+  uint32_t step = timestamp - this->previous_timestamp;
+  uint32_t deltas[HISTORY_CODEC_MAX_CHANNELS];
+
+  if(this->sample_count == 0) {
+    step = 0;
+    record_size += write_varint(record, timestamp);
+    for(uint8_t channel = 0; channel < this->channel_count; channel++) {
+      deltas[channel] = 0;
+      record_size += write_varint(record + record_size, values[channel]);
+    }
+  }
+  else {
+    bool repeats = this->run_length && step == this->previous_step;
+    for(uint8_t channel = 0; channel < this->channel_count; channel++) {
+      deltas[channel] = values[channel] - this->previous_values[channel];
+      if(deltas[channel] != this->previous_deltas[channel]) repeats = false;
+    }
+
+    // Same step as the last sample, only the open run grows
+    if(repeats) {
+      if(this->length + this->get_run_size(this->run_count + 1) > this->capacity) return false;
+
+      this->run_count++;
+      this->sample_count++;
+      this->previous_timestamp = timestamp;
+      memcpy(this->previous_values, values, this->channel_count * sizeof(uint32_t));
+      return true;
+    }
+
+    uint64_t tag = (uint64_t) zigzag(step - this->previous_step) << 1;
+    record_size += write_varint(record, tag);
+    for(uint8_t channel = 0; channel < this->channel_count; channel++) {
+      record_size += write_varint(record + record_size, zigzag(deltas[channel]));
+    }
+  }
+
+  if(this->length + this->get_run_size(this->run_count) + record_size > this->capacity) return false;
+
+  this->finish();
+  memcpy(this->buffer + this->length, record, record_size);
+  this->length += record_size;
+
+  this->sample_count++;
+  this->previous_timestamp = timestamp;
+  this->previous_step = step;
+  memcpy(this->previous_values, values, this->channel_count * sizeof(uint32_t));
+  memcpy(this->previous_deltas, deltas, this->channel_count * sizeof(uint32_t));
+
+  return true;
+}
+
+size_t HistoryEncoder::finish() {
+  if(this->run_count > 0) {
+    this->length += write_varint(this->buffer + this->length, HISTORY_CODEC_RUN_TAG);
+    this->length += write_varint(this->buffer + this->length, this->run_count);
+    this->run_count = 0;
+  }
+
+  return this->length;
+}
+
+uint32_t HistoryEncoder::get_sample_count() const {
+  return this->sample_count;
+}
+
+size_t HistoryEncoder::get_run_size(uint32_t run_count) const {
+  if(run_count == 0) return 0;
+  return get_varint_size(HISTORY_CODEC_RUN_TAG) + get_varint_size(run_count);
+}
+
+
+
+//? Decoder
+bool HistoryDecoder::begin(const uint8_t *data, size_t length) {
+  this->data = data;
+  this->length = length;
+  this->offset = HISTORY_CODEC_HEADER_SIZE;
+  this->error = false;
+  this->sample_count = 0;
+  this->run_remaining = 0;
+  this->timestamp = 0;
+  this->step = 0;
+  memset(this->values, 0, sizeof(this->values));
+  memset(this->deltas, 0, sizeof(this->deltas));
+
+  if(length < HISTORY_CODEC_HEADER_SIZE
+    || data[0] != HISTORY_CODEC_VERSION
+    || data[1] > HISTORY_CODEC_MAX_CHANNELS) {
+    this->error = true;
+    return false;
+  }
+
+  this->channel_count = data[1];
+  return true;
+}
+
+bool HistoryDecoder::next(uint32_t &timestamp, uint32_t *values) {
+  if(this->error) return false;
+
+  if(this->run_remaining > 0) {
+    this->run_remaining--;
+    this->apply_step();
+  }
+  else {
+    if(this->offset >= this->length) return false;
+    if(!this->read_record()) return false;
+  }
+
+  this->sample_count++;
+  timestamp = this->timestamp;
+  memcpy(values, this->values, this->channel_count * sizeof(uint32_t));
+  return true;
+}
+
+uint8_t HistoryDecoder::get_channel_count() const {
+  return this->channel_count;
+}
+
+bool HistoryDecoder::has_error() const {
+  return this->error;
+}
+
+bool HistoryDecoder::read_record() {
+  uint64_t value = 0;
+
+  if(this->sample_count == 0) {
+    if(!this->read_varint(value)) return false;
+    this->timestamp = (uint32_t) value;
+
+    for(uint8_t channel = 0; channel < this->channel_count; channel++) {
+      if(!this->read_varint(value)) return false;
+      this->values[channel] = (uint32_t) value;
+    }
+    return true;
+  }
+
+  uint64_t tag = 0;
+  if(!this->read_varint(tag)) return false;
+
+  if(tag & 1) {
+    if(tag != HISTORY_CODEC_RUN_TAG || !this->read_varint(value) || value == 0) {
+      this->error = true;
+      return false;
+    }
+    this->run_remaining = (uint32_t) value - 1;
+  }
+  else {
+    this->step += unzigzag((uint32_t) (tag >> 1));
+    for(uint8_t channel = 0; channel < this->channel_count; channel++) {
+      if(!this->read_varint(value)) return false;
+      this->deltas[channel] = unzigzag((uint32_t) value);
+    }
+  }
+
+  this->apply_step();
+  return true;
+}
+
+void HistoryDecoder::apply_step() {
+  this->timestamp += this->step;
+  for(uint8_t channel = 0; channel < this->channel_count; channel++) {
+    this->values[channel] += this->deltas[channel];
+  }
+}
+
+bool HistoryDecoder::read_varint(uint64_t &value) {
+  value = 0;
+  for(uint8_t shift = 0; shift < 64; shift += 7) {
+    if(this->offset >= this->length) break;
+
+    uint8_t byte = this->data[this->offset++];
+    value |= (uint64_t) (byte & 0x7F) << shift;
+    if((byte & 0x80) == 0) return true;
+  }
+
+  // Cut off or longer than any value the encoder writes
+  this->error = true;
+  return false;
+}
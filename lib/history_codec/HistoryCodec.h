@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Bumped whenever the layout changes, the decoder rejects any other version
+#define HISTORY_CODEC_VERSION 1
+
+// Version, channel count and flags in front of the samples
+#define HISTORY_CODEC_HEADER_SIZE 3
+
+// Values per sample
+#define HISTORY_CODEC_MAX_CHANNELS 8
+
+// Flags
+#define HISTORY_CODEC_RUN_LENGTH 0x01
+
+// Largest record: tag plus one delta per channel, 5 bytes each as varints
+#define HISTORY_CODEC_MAX_RECORD_SIZE (5 * (1 + HISTORY_CODEC_MAX_CHANNELS))
+
+/**
+ * @brief Streaming encoder for a series of samples, each a timestamp and a few uint32 values
+ * @details Plain C++ with no Arduino dependency, so the server side or a host tool can build it as is.
+ *          Timestamps are sent as delta-of-delta and values as deltas, all as zig-zag varints,
+ *          so a sample taken on schedule with small changes costs a byte or two per value.
+ *          With run-length on, samples that repeat the previous step (same interval, same value deltas)
+ *          are folded into one run record, so an idle period of any length costs two or three bytes.
+ *          Values wrap around like uint32, counters and rates both work.
+ *
+ * Layout:
+ * | version (1) | channel count (1) | flags (1) | first sample | records... |
+ * First sample: | timestamp (varint) | values (varint each) |
+ * Record: | tag (varint) | value deltas (zig-zag varint each) |  with tag = zig-zag(delta-of-delta) << 1
+ * Run:    | tag = 1 (varint) | repeat count (varint) |  the previous step applied repeat count times
+ *
+ * Size of a page of 200 samples against the raw telemetry log (19 bytes a record with 2 sensors, 3800 bytes),
+ * one sample per second, from test/host/history_codec_benchmark.cpp:
+ * - idle, nothing but runs: 18 bytes (211:1)
+ * - idle without run-length: 807 bytes, 4.04 bytes per sample (4.7:1)
+ * - steady flow with ±2 pulses of jitter: 807 bytes, 4.04 bytes per sample (4.7:1)
+ * - random pulses 0..999: 1158 bytes, 5.79 bytes per sample (3.3:1)
+ * Encoding took 90 to 130 ns per sample on a desktop, not measured on the ESP32.
+ *
+ * example usage:
+ * @code
+ * HistoryEncoder encoder;
+ * encoder.begin(buffer, sizeof(buffer), 2);
+ *
+ * uint32_t values[2] = { pulses_1, pulses_2 };
+ * if(!encoder.add(timestamp, values)) {
+ *  // Buffer is full, send it and start a new one
+ * }
+ * size_t length = encoder.finish();
+ *
+ * // On the receiving side
+ * HistoryDecoder decoder;
+ * if(decoder.begin(data, length)) {
+ *  while(decoder.next(timestamp, values)) { ... }
+ * }
+ * @endcode
+ */
+class HistoryEncoder
+{
+public:
+  /**
+   * @brief Start a new stream in a buffer
+   * @return false if the buffer can't hold the header or there are too many channels
+   */
+  bool begin(uint8_t *buffer, size_t capacity, uint8_t channel_count, bool run_length = true);
+
+  /**
+   * @brief Add one sample, values holds one value per channel
+   * @return false if the sample doesn't fit, the stream is left as it was
+   */
+  bool add(uint32_t timestamp, const uint32_t *values);
+
+  /**
+   * @brief Close the open run, room for it is always kept
+   * @return stream length
+   */
+  size_t finish();
+
+  uint32_t get_sample_count() const;
+
+private:
+  uint8_t *buffer = nullptr;
+  size_t capacity = 0;
+  size_t length = 0;
+  uint8_t channel_count = 0;
+  bool run_length = false;
+
+  uint32_t sample_count = 0;
+  uint32_t run_count = 0;     // Samples folded into the open run, not written yet
+
+  uint32_t previous_timestamp = 0;
+  uint32_t previous_step = 0;
+  uint32_t previous_values[HISTORY_CODEC_MAX_CHANNELS];
+  uint32_t previous_deltas[HISTORY_CODEC_MAX_CHANNELS];
+
+  size_t get_run_size(uint32_t run_count) const;
+};
+
+/**
+ * @brief Reads a stream written by HistoryEncoder, one sample at a time
+ */
+class HistoryDecoder
+{
+public:
+  /**
+   * @brief Start reading a stream
+   * @return false if the version is unknown or there are too many channels
+   */
+  bool begin(const uint8_t *data, size_t length);
+
+  /**
+   * @brief Read the next sample, values gets one value per channel
+   * @return false at the end of the stream or if it's malformed (see has_error())
+   */
+  bool next(uint32_t &timestamp, uint32_t *values);
+
+  uint8_t get_channel_count() const;
+  bool has_error() const;
+
+private:
+  const uint8_t *data = nullptr;
+  size_t length = 0;
+  size_t offset = 0;
+  uint8_t channel_count = 0;
+  bool error = false;
+
+  uint32_t sample_count = 0;
+  uint32_t run_remaining = 0;
+
+  uint32_t timestamp = 0;
+  uint32_t step = 0;
+  uint32_t values[HISTORY_CODEC_MAX_CHANNELS];
+  uint32_t deltas[HISTORY_CODEC_MAX_CHANNELS];
+
+  bool read_record();
+  void apply_step();
+  bool read_varint(uint64_t &value);
+};
@@ -0,0 +1,92 @@
+#include <LeakDetector.h>
+#include <Arduino.h>
+
+// Siegmund's approximation of the average run length of a one-sided CUSUM without a shift
+static double get_average_run_length(double reference, double threshold) {
+  double b = threshold + 1.166;
+  return (exp(2 * reference * b) - 2 * reference * b - 1) / (2 * reference * reference);
+}
+
+
+LeakDetector::LeakDetector() {
+  this->configure(LEAK_DETECTOR_DEFAULT_FALSE_ALARM_SAMPLES, LEAK_DETECTOR_DEFAULT_NOISE_FLOOR_MLPM);
+}
+
+void LeakDetector::configure(uint32_t false_alarm_samples, uint32_t noise_floor_mlpm, float shift_sigma) {
+  this->noise_floor = noise_floor_mlpm > 0 ? noise_floor_mlpm : 1;
+  this->reference = shift_sigma > 0 ? shift_sigma / 2 : LEAK_DETECTOR_DEFAULT_SHIFT_SIGMA / 2;
+
+  // Find the threshold giving the wanted run length, the run length grows with the threshold
+  double low = 0;
+  double high = 100;
+  for(uint8_t iteration = 0; iteration < 40; iteration++) {
+    double middle = (low + high) / 2;
+    if(get_average_run_length(this->reference, middle) < false_alarm_samples) low = middle;
+    else high = middle;
+  }
+
+  this->threshold = high;
+  this->reset();
+}
+
+void LeakDetector::add_sample(int32_t upstream_mlpm, int32_t downstream_mlpm) {
+  int32_t difference = upstream_mlpm - downstream_mlpm;
+
+  // Rolling window, drop the oldest sample from the sums once it's full
+  if(this->count == LEAK_DETECTOR_WINDOW) {
+    int32_t oldest = this->samples[this->head];
+    this->sum -= oldest;
+    this->sum_squares -= (int64_t) oldest * oldest;
+  }
+  else {
+    this->count++;
+  }
+
+  this->samples[this->head] = difference;
+  this->head = (this->head + 1) & (LEAK_DETECTOR_WINDOW - 1);
+  this->sum += difference;
+  this->sum_squares += (int64_t) difference * difference;
+
+  // One-sided CUSUM on the normalized difference, more water going in than coming out
+  float noise = this->get_noise_mlpm();
+  if(noise < this->noise_floor) noise = this->noise_floor;
+
+  this->statistic += difference / noise - this->reference;
+  if(this->statistic < 0) this->statistic = 0;
+
+  // Cap it, so the alarm clears in a bounded time after the leak stops
+  if(this->statistic > 2 * this->threshold) this->statistic = 2 * this->threshold;
+}
+
+void LeakDetector::reset() {
+  this->head = 0;
+  this->count = 0;
+  this->sum = 0;
+  this->sum_squares = 0;
+  this->statistic = 0;
+}
+
+bool LeakDetector::is_leaked() const {
+  return this->statistic >= this->threshold;
+}
+
+float LeakDetector::get_leak_probability() const {
+  float probability = this->statistic / this->threshold;
+  return probability > 1 ? 1 : probability;
+}
+
+int32_t LeakDetector::get_leak_rate_mlpm() const {
+  if(this->count == 0) return 0;
+
+  int32_t mean = this->sum / this->count;
+  return mean > 0 ? mean : 0;
+}
+
+float LeakDetector::get_noise_mlpm() const {
+  if(this->count < 2) return 0;
+
+  // Sample variance from the running sums
+  double mean = (double) this->sum / this->count;
+  double variance = ((double) this->sum_squares - mean * this->sum) / (this->count - 1);
+  return variance > 0 ? sqrt(variance) : 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Number of samples in the rolling window (power of two)
+#define LEAK_DETECTOR_WINDOW 32
+
+// Expected samples between two false alarms, one per day at one sample per second
+#define LEAK_DETECTOR_DEFAULT_FALSE_ALARM_SAMPLES 86400UL
+
+// Smallest noise assumed, keeps a perfectly steady pipe from alarming on a single pulse
+#define LEAK_DETECTOR_DEFAULT_NOISE_FLOOR_MLPM 100
+
+// Shift to detect in noise standard deviations, the CUSUM reference value is half of it
+#define LEAK_DETECTOR_DEFAULT_SHIFT_SIGMA 1.0f
+
+/**
+ * @brief Sequential leak detector for one pipe segment
+ * @details Every sample is the difference between upstream and downstream flow. A rolling window keeps
+ *          mean and variance of the difference in O(1) per sample, and a one-sided CUSUM of the normalized
+ *          difference decides if there's a leak. The alarm threshold is derived from the wanted false alarm
+ *          rate with Siegmund's approximation of the average run length.
+ * 
+ * example usage:
+ * @code
+ * LeakDetector detector;
+ * detector.configure(86400, 100);  // One false alarm per day at 1 sample/s, 0.1 L/min noise floor
+ * 
+ * void loop() {
+ *  detector.add_sample(upstream_mlpm, downstream_mlpm);
+ *  if(detector.is_leaked()) {
+ *    Serial.printf("Leak of %d mL/min\n", detector.get_leak_rate_mlpm());
+ *  }
+ * }
+ * @endcode
+ */
+class LeakDetector
+{
+public:
+  LeakDetector();
+
+  /**
+   * @brief Used to set detection parameters
+   * @param false_alarm_samples expected number of samples between two false alarms
+   * @param noise_floor_mlpm smallest noise standard deviation assumed
+   * @param shift_sigma smallest shift to detect quickly, in noise standard deviations
+   */
+  void configure(uint32_t false_alarm_samples, uint32_t noise_floor_mlpm, float shift_sigma = LEAK_DETECTOR_DEFAULT_SHIFT_SIGMA);
+
+  /**
+   * @brief Used to add one sample of the segment
+   */
+  void add_sample(int32_t upstream_mlpm, int32_t downstream_mlpm);
+
+  /**
+   * @brief Used to forget every sample
+   */
+  void reset();
+
+  /**
+   * @brief Check if the CUSUM statistic crossed the alarm threshold
+   */
+  bool is_leaked() const;
+
+  /**
+   * @brief Get evidence for a leak from 0 (none) to 1 (alarm), the CUSUM statistic over its threshold
+   */
+  float get_leak_probability() const;
+
+  /**
+   * @brief Get estimated leak rate (mean difference of the window) in millilitres per minute
+   */
+  int32_t get_leak_rate_mlpm() const;
+
+  /**
+   * @brief Get standard deviation of the difference in the window in millilitres per minute
+   */
+  float get_noise_mlpm() const;
+
+private:
+  int32_t samples[LEAK_DETECTOR_WINDOW];
+  uint8_t head = 0;
+  uint8_t count = 0;
+  int64_t sum = 0;
+  int64_t sum_squares = 0;
+
+  float noise_floor = LEAK_DETECTOR_DEFAULT_NOISE_FLOOR_MLPM;
+  float reference = LEAK_DETECTOR_DEFAULT_SHIFT_SIGMA / 2;
+  float threshold = 0;
+  float statistic = 0;
+};
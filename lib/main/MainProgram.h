@@ -3,7 +3,14 @@
 #include <WebSocketManager.h>       // Custom web socket handler library
 #include <ConfigurationManager.h>   // Custom configuration through bluetooth library
 #include <WaterLeakageGuard.h>      // Custom water leakage monitoring library
+#include <TotalizerStore.h>         // Custom flow totals checkpoint library
+#include <NightFlowAnalyzer.h>      // Custom background leak analysis library
+#include <FlowHistory.h>            // Custom flow time series library
+#include <TelemetryLog.h>           // Custom offline telemetry log library
+#include <CommandDispatcher.h>      // Custom server command parsing library
+#include <ReportPolicy.h>           // Custom change based reporting library
 #include <HTTPUpdateServer.h>
+#include <Update.h>
 #include <WebServer.h>
 #include <ESPmDNS.h>
 
@@ -18,6 +25,8 @@
 
 #define WATER_FLOW_SENSOR_1_PIN 4
 #define WATER_FLOW_SENSOR_2_PIN 2
+#define WATER_FLOW_SENSOR_COUNT 2
+static_assert(WATER_FLOW_SENSOR_COUNT <= CONFIG_MAX_SENSORS, "Every sensor needs its pins and calibration in the configuration");
 
 #define BUZZER_SENSOR_1_PIN 5
 #define BUZZER_SENSOR_2_PIN 17
@@ -32,20 +41,57 @@
 #define OFF LOW
 
 #define INTERVAL_PER_DATA 2000
+#define WS_SERVER_PORT 8040
+#define MIN_REPORT_INTERVAL 200         // Fastest heartbeat the server can ask for
+#define MAX_REPORT_INTERVAL 3600000UL   // Slowest heartbeat the server can ask for
+
+// Flow report policy of every sensor
+#define REPORT_FLOW_DEADBAND_MLPM 100       // Changes under 0.1 L/min...
+#define REPORT_FLOW_DEADBAND_RELATIVE 0.05f // ...or under 5% of the reported flow aren't worth a report
+#define REPORT_FLOW_RATE_OF_CHANGE 2000     // Flow moving 2 L/min in a second (a tap opening, a burst) goes out at once
+#define REPORT_MIN_INTERVAL_MS 1000         // Deadband reports at most once a second
+#define REPORT_MAX_INTERVAL_MS 60000        // Heartbeat, a snapshot at least once a minute
+#define DELAY_BEFORE_REBOOT 500         // Time for the reboot acknowledgement to leave
 #define INTERVAL_FOR_WIFI_INDICATOR 1000
 #define INTERVAL_OTA_PROGRESS_UPDATE 1000
+#define INTERVAL_TELEMETRY_UPLOAD 5000 // Resend a log page if the server didn't acknowledge it
+#define BENCH_MAX_MESSAGES 500          // Longest burst the bench command sends, keeps the loop stall short
 
 #define NORMAL_MODE 0
 #define CONFIGURATION_MODE 1
 
 #define CURRENT_MODE digitalRead(CONFIG_SWITCH_PIN)
 
+#define NTP_SERVER "pool.ntp.org"
+#define MIN_VALID_TIME 1577836800 // Anything before 2020 means the clock isn't set yet
+
+// POSIX timezone used for the night flow window, define it in env.h for other timezones
+#ifndef ENV_TIMEZONE
+#define ENV_TIMEZONE "UTC0"
+#endif
+
 //? ------> [VARIABLES] Data
  
 // Web Socket data communication
 uint64_t last_time_update_data = 0UL;
 WebSocketManager ws_manager;
 WaterLeakageGuard water_leakage_guard;
+TotalizerStore totalizer_store;
+NightFlowAnalyzer night_flow_analyzer;
+FlowHistory flow_histories[WATER_FLOW_SENSOR_COUNT];
+
+// Offline telemetry log
+TelemetryLog telemetry_log;
+uint8_t telemetry_batch[TELEMETRY_LOG_BATCH_MAX_SIZE];
+#ifdef ENV_COMPRESSED_TELEMETRY_LOG
+uint8_t compressed_telemetry_batch[TELEMETRY_LOG_BATCH_MAX_SIZE];
+#endif
+uint64_t last_telemetry_upload = 0UL;
+bool telemetry_upload_waiting = false;
+
+// Remote commands
+CommandDispatcher command_dispatcher;
+uint64_t reboot_time = 0UL;
 
 // WiFi states
 bool wifi_configurated = false;
@@ -57,13 +103,14 @@ uint64_t last_wifi_led_changed = 0UL;
 uint8_t previous_mode = NORMAL_MODE;
 
 // Water Flow data
-uint8_t previous_water_flow_value = 0;
-uint8_t previous_water_leak_value = 0;
+ReportPolicy flow_report_policies[WATER_FLOW_SENSOR_COUNT];
+bool previous_background_leak = false;
 
 // Arduino OTA
 WebServer sync_server(8080);
 HTTPUpdateServer http_ota_updater;
 uint64_t last_ota_progress_update = 0UL;
+bool ota_in_progress = false;
 
 //? ------> [FUNCTIONS] Function Definitions
 
@@ -77,12 +124,26 @@ void loop_normal_mode();
 
 // Water Leakage Handler functions
 void monitor_water_leakage();
+void record_flow_sample();
+void on_leak_state_changed(uint8_t segment_index, LeakState previous_state, LeakState state);
+void restore_totals();
+void checkpoint_totals(bool force);
+
+// Telemetry Log functions
+void log_telemetry_record();
+void upload_telemetry_log();
+bool launch_frame(TelemetryFrameKind kind);
+bool launch_snapshot();
+void report_flow_changes();
+void configure_report_policies(uint32_t max_interval_ms);
+uint32_t get_timestamp();
 
 // WiFi functions
 void check_wifi_connection();
 void connect_wifi(String ssid, String pass);
 
 // Elegant OTA Listener
+void on_ota_update(size_t current, size_t final);
 void on_ota_start();
 void on_ota_progress(size_t current, size_t final);
 void on_ota_end(bool success);
@@ -90,6 +151,16 @@ void on_ota_end(bool success);
 // Web Socket Listener 
 void on_websocket_data(WEBSOCKET_DATA);
 
+// Remote Command functions
+void register_commands();
+CommandStatus on_snapshot_command(const CommandArguments &arguments);
+CommandStatus on_interval_command(const CommandArguments &arguments);
+CommandStatus on_thresholds_command(const CommandArguments &arguments);
+CommandStatus on_calibration_command(const CommandArguments &arguments);
+CommandStatus on_silence_command(const CommandArguments &arguments);
+CommandStatus on_reboot_command(const CommandArguments &arguments);
+CommandStatus on_bench_command(const CommandArguments &arguments);
+
 //? ------> [SETUP] Executed Once Program
 
 void setup() {  
@@ -107,9 +178,56 @@ void setup() {
   pinMode(WIFI_INDICATOR_PIN, OUTPUT);
   pinMode(WIFI_INDICATOR_PIN, OUTPUT);
 
-  // Setup Water Flow Sensors
-  water_leakage_guard.add_sensor(WATER_FLOW_SENSOR_1_PIN, BUZZER_SENSOR_1_PIN);
-  water_leakage_guard.add_sensor(WATER_FLOW_SENSOR_2_PIN, BUZZER_SENSOR_2_PIN);
+  // Everything saved is read once here, the rest of the program reads it from RAM
+  ConfigurationManager::begin();
+  const DeviceConfig &config = ConfigurationManager::get_config();
+
+  // Setup Water Flow Sensors, wiring from the configuration or the build-time pins
+  const uint8_t sensor_pins[WATER_FLOW_SENSOR_COUNT] = { WATER_FLOW_SENSOR_1_PIN, WATER_FLOW_SENSOR_2_PIN };
+  const uint8_t buzzer_pins[WATER_FLOW_SENSOR_COUNT] = { BUZZER_SENSOR_1_PIN, BUZZER_SENSOR_2_PIN };
+  for(uint8_t sensor_index = 0; sensor_index < WATER_FLOW_SENSOR_COUNT; sensor_index++) {
+    uint8_t sensor_pin = config.sensor_pins[sensor_index] != CONFIG_PIN_UNSET ? config.sensor_pins[sensor_index] : sensor_pins[sensor_index];
+    uint8_t buzzer_pin = config.buzzer_pins[sensor_index] != CONFIG_PIN_UNSET ? config.buzzer_pins[sensor_index] : buzzer_pins[sensor_index];
+    water_leakage_guard.add_sensor(sensor_pin, buzzer_pin);
+  }
+
+  // Load calibration curves, fall back to the build-time table
+  for(uint8_t sensor_index = 0; sensor_index < WATER_FLOW_SENSOR_COUNT; sensor_index++) {
+    CalibrationCurve curve;
+    if(!ConfigurationManager::get_calibration(sensor_index, curve)) {
+      curve = YF_S201_CALIBRATION;
+    }
+    water_leakage_guard.set_calibration(sensor_index, curve);
+  }
+
+  // Leak detection sensitivity the server asked for before the reboot
+  if(config.false_alarm_samples != 0) {
+    water_leakage_guard.configure_leak_detection(config.false_alarm_samples, config.noise_floor_mlpm);
+  }
+
+  // Continue the totals from before the reboot
+  restore_totals();
+
+  // Sample every sensor at the same instant
+  water_leakage_guard.begin();
+
+  // Raise and clear alarms as soon as the leak state changes
+  water_leakage_guard.subscribe(on_leak_state_changed);
+
+  // Keep samples on flash while the server can't be reached
+  telemetry_log.begin();
+
+  // Report flow when it changes instead of every sample
+  configure_report_policies(config.report_interval_ms != 0 ? config.report_interval_ms : REPORT_MAX_INTERVAL_MS);
+
+  // Listen to the server, kept across reconnections
+  register_commands();
+  ws_manager.listen(on_websocket_data);
+
+  // Connects by itself once the WiFi is up, and reconnects after outages
+  const char *server_address = config.server_address[0] != '\0' ? config.server_address : ENV_WS_ADDR;
+  uint16_t server_port = config.server_port != 0 ? config.server_port : WS_SERVER_PORT;
+  ws_manager.init(server_address, server_port);
   
 
   // Setup WiFi
@@ -147,6 +265,12 @@ void loop() {
   if(wifi_connected) {
     // Run the OTA updater :|
     sync_server.handleClient();
+
+    // Upload stopped, either finished or aborted
+    if(ota_in_progress && !Update.isRunning()) {
+      ota_in_progress = false;
+      on_ota_end(!Update.hasError());
+    }
   }
 }
 
@@ -178,9 +302,9 @@ void check_wifi_connection() {
       Serial.println(WiFi.gatewayIP());
       #endif
 
-      
-      // Begin connection to WebSocket
-      ws_manager.init(ENV_WS_ADDR, (uint16_t) 8040);
+
+      // Sync the clock for the night flow window
+      configTzTime(ENV_TIMEZONE, NTP_SERVER);
 
 
       // Begin OTA Setup
@@ -189,6 +313,7 @@ void check_wifi_connection() {
       }
 
       http_ota_updater.setup(&sync_server);
+      Update.onProgress(on_ota_update);
       Serial.print("[OTA] Async OTA started!\n");
 
       sync_server.begin();
@@ -247,6 +372,24 @@ void on_websocket_data(WEBSOCKET_DATA) {
 
     case WStype_TEXT:
       Serial.printf("[WebSocket] Message from server: %s\n", payload);
+
+      // Server stored a telemetry log page
+      if(length > 7 && strncmp((const char *) payload, "logack=", 7) == 0) {
+        telemetry_log.acknowledge(strtoul((const char *) payload + 7, nullptr, 10));
+        telemetry_upload_waiting = false;
+      }
+
+      // Server wants something done, run it right away and tell how it went
+      if(CommandDispatcher::is_command(payload, length)) {
+        uint32_t id;
+        CommandStatus status = command_dispatcher.dispatch(payload, length, id);
+
+        ws_manager.put("ack=");
+        ws_manager.put(id);
+        ws_manager.put(',');
+        ws_manager.put((uint8_t) status);
+        ws_manager.launch();
+      }
       break;
 
     case WStype_BIN:
@@ -255,13 +398,183 @@ void on_websocket_data(WEBSOCKET_DATA) {
   }
 }
 
+/**
+ * @brief Register every command the server can send
+ * @details Commands are "cmd=<id>,<name>[,<argument>...]", acknowledged with "ack=<id>,<status>" (CommandStatus)
+ * - snapshot: send a snapshot now
+ * - interval,<ms>: change and save the heartbeat, the longest time between two snapshots
+ * - thresholds,<false alarm samples>,<noise floor mL/min>: change and save leak detection sensitivity
+ * - calibration,<sensor>,<mHz>,<mL/min>,...: replace and save the calibration curve of a sensor
+ * - silence: turn every buzzer off until the next confirmed leak
+ * - reboot: restart the device
+ * - bench,<count>,<bytes>[,<binary>]: send a burst of messages and report the throughput (see on_bench_command())
+ * 
+ */
+void register_commands() {
+  command_dispatcher.on("snapshot", on_snapshot_command);
+  command_dispatcher.on("interval", on_interval_command);
+  command_dispatcher.on("thresholds", on_thresholds_command);
+  command_dispatcher.on("calibration", on_calibration_command);
+  command_dispatcher.on("silence", on_silence_command);
+  command_dispatcher.on("reboot", on_reboot_command);
+  command_dispatcher.on("bench", on_bench_command);
+}
+
+CommandStatus on_snapshot_command(const CommandArguments &arguments) {
+  return launch_snapshot() ? COMMAND_OK : COMMAND_FAILED;
+}
+
+CommandStatus on_interval_command(const CommandArguments &arguments) {
+  uint32_t interval;
+  if(!arguments.get_uint(0, interval)) return COMMAND_BAD_ARGUMENTS;
+  if(interval < MIN_REPORT_INTERVAL || interval > MAX_REPORT_INTERVAL) return COMMAND_BAD_ARGUMENTS;
+
+  configure_report_policies(interval);
+
+  // Keep it for the next boot
+  DeviceConfig config = ConfigurationManager::get_config();
+  config.report_interval_ms = interval;
+  return ConfigurationManager::set_config(config) ? COMMAND_OK : COMMAND_FAILED;
+}
+
+CommandStatus on_thresholds_command(const CommandArguments &arguments) {
+  uint32_t false_alarm_samples;
+  uint32_t noise_floor_mlpm;
+  if(!arguments.get_uint(0, false_alarm_samples) || !arguments.get_uint(1, noise_floor_mlpm)) return COMMAND_BAD_ARGUMENTS;
+  if(false_alarm_samples == 0) return COMMAND_BAD_ARGUMENTS;
+
+  water_leakage_guard.configure_leak_detection(false_alarm_samples, noise_floor_mlpm);
+
+  // Keep it for the next boot
+  DeviceConfig config = ConfigurationManager::get_config();
+  config.false_alarm_samples = false_alarm_samples;
+  config.noise_floor_mlpm = noise_floor_mlpm;
+  return ConfigurationManager::set_config(config) ? COMMAND_OK : COMMAND_FAILED;
+}
+
+CommandStatus on_calibration_command(const CommandArguments &arguments) {
+  uint32_t sensor_index;
+  if(!arguments.get_uint(0, sensor_index) || sensor_index >= water_leakage_guard.get_sensor_count()) return COMMAND_BAD_ARGUMENTS;
+
+  // Points come in pairs after the sensor index
+  uint8_t point_count = (arguments.count() - 1) / 2;
+  if(arguments.count() % 2 == 0 || point_count > CALIBRATION_CURVE_MAX_POINTS) return COMMAND_BAD_ARGUMENTS;
+
+  CalibrationCurve curve = {};
+  curve.size = point_count;
+  for(uint8_t index = 0; index < point_count; index++) {
+    CalibrationPoint &point = curve.points[index];
+    if(!arguments.get_uint(1 + index * 2, point.frequency_mhz) || !arguments.get_uint(2 + index * 2, point.flow_mlpm)) {
+      return COMMAND_BAD_ARGUMENTS;
+    }
+  }
+
+  if(!water_leakage_guard.set_calibration(sensor_index, curve)) return COMMAND_BAD_ARGUMENTS;
+
+  // Keep it for the next boot
+  return ConfigurationManager::set_calibration(sensor_index, curve) ? COMMAND_OK : COMMAND_FAILED;
+}
+
+CommandStatus on_silence_command(const CommandArguments &arguments) {
+  water_leakage_guard.clear_warning();
+  return COMMAND_OK;
+}
+
+CommandStatus on_reboot_command(const CommandArguments &arguments) {
+  // Reboot from the loop, after the acknowledgement is sent
+  reboot_time = millis() + DELAY_BEFORE_REBOOT;
+  return COMMAND_OK;
+}
+
+/**
+ * @brief Measure the web socket against the live server with a burst of messages
+ * @details Sends <count> messages of about <bytes> bytes back to back, "bench=<index>,xxx..." text built with put(),
+ *          or flow frames when <binary> is 1, then replies with
+ *          "bench=<binary>,<messages>,<messages/s>,<bytes/s>,<p50 bound us>,<p99 bound us>,<heap held bytes>".
+ *          The bounds are the power of two send time histogram buckets that half and 99% of the messages fall in,
+ *          not percentiles. Heap held is the free heap lost over the burst, not an allocation count, anything
+ *          freed before the burst ends doesn't show up. test/host/websocket_benchmark.cpp measures both exactly.
+ * 
+ */
+CommandStatus on_bench_command(const CommandArguments &arguments) {
+  uint32_t count;
+  uint32_t size;
+  uint32_t binary = 0;
+  if(!arguments.get_uint(0, count) || !arguments.get_uint(1, size)) return COMMAND_BAD_ARGUMENTS;
+  if(arguments.count() > 2 && !arguments.get_uint(2, binary)) return COMMAND_BAD_ARGUMENTS;
+  if(count == 0 || count > BENCH_MAX_MESSAGES || size > WS_PAYLOAD_CAPACITY || binary > 1) return COMMAND_BAD_ARGUMENTS;
+  if(!ws_manager.is_connected()) return COMMAND_FAILED;
+
+  char filler[WS_PAYLOAD_CAPACITY + 1];
+  memset(filler, 'x', sizeof(filler) - 1);
+
+  TelemetryFrame frame = {};
+  frame.kind = TELEMETRY_FRAME_FLOW;
+  frame.value_count = size > TELEMETRY_FRAME_HEADER_SIZE ? min((size - TELEMETRY_FRAME_HEADER_SIZE) / 4, (uint32_t) TELEMETRY_FRAME_MAX_VALUES) : 0;
+
+  WebSocketStats before = ws_manager.get_stats();
+  uint32_t free_heap = ESP.getFreeHeap();
+  uint32_t start_time = micros();
+
+  for(uint32_t index = 0; index < count; index++) {
+    if(binary) {
+      frame.timestamp = index;
+      ws_manager.launch(frame);
+      continue;
+    }
+
+    // "bench=" and the index are part of the size
+    uint32_t length = 6 + (index < 10 ? 1 : index < 100 ? 2 : 3) + 1;
+    uint32_t padding = size > length ? size - length : 0;
+    filler[padding] = '\0';
+
+    ws_manager.put("bench=");
+    ws_manager.put(index);
+    ws_manager.put(',');
+    ws_manager.put(filler);
+    ws_manager.launch();
+
+    filler[padding] = 'x';
+  }
+
+  uint32_t elapsed = micros() - start_time;
+  int heap_held = (int) free_heap - (int) ESP.getFreeHeap();
+
+  // Only the burst, not what was sent before it
+  const WebSocketStats &after = ws_manager.get_stats();
+  WebSocketStats burst = {};
+  burst.messages = after.messages - before.messages;
+  burst.bytes = after.bytes - before.bytes;
+  for(uint8_t bucket = 0; bucket < WS_LATENCY_BUCKETS; bucket++) {
+    burst.latency_histogram[bucket] = after.latency_histogram[bucket] - before.latency_histogram[bucket];
+  }
+
+  if(elapsed == 0) elapsed = 1;
+
+  ws_manager.put("bench=");
+  ws_manager.put((uint8_t) binary);
+  ws_manager.put(',');
+  ws_manager.put(burst.messages);
+  ws_manager.put(',');
+  ws_manager.put((uint32_t) ((uint64_t) burst.messages * 1000000ULL / elapsed));
+  ws_manager.put(',');
+  ws_manager.put((uint32_t) (burst.bytes * 1000000ULL / elapsed));
+  ws_manager.put(',');
+  ws_manager.put(burst.get_latency_bound(50));
+  ws_manager.put(',');
+  ws_manager.put(burst.get_latency_bound(99));
+  ws_manager.put(',');
+  ws_manager.put(heap_held);
+  return ws_manager.launch() ? COMMAND_OK : COMMAND_FAILED;
+}
+
 /**
  * @brief Starting normal mode
  * @attention This function should be called when starting normal mode
  * 
  */
 void start_normal_mode() {
-  // Get the WiFi SSID and PASS from persistance storage
+  // Get the WiFi SSID and PASS from the configuration loaded at boot
   String ssid = "";
   String pass = "";
   ConfigurationManager::get_wifi_creds(ssid, pass);
@@ -315,10 +628,14 @@ void stop_configuration_mode() {
  *
  */
 void loop_normal_mode() {
-  // Check if WiFi is connected
-  if(wifi_connected) {
-    // Looping web socket connection to make it works smoothly :D
-    ws_manager.loop();
+  // Looping web socket connection to make it works smoothly :D (never blocks on outages)
+  ws_manager.loop();
+
+  // Server asked for a reboot, save what would be lost first
+  if(reboot_time != 0 && millis() >= reboot_time) {
+    checkpoint_totals(true);
+    telemetry_log.flush();
+    ESP.restart();
   }
 
   // Check water leakage per some time :>
@@ -333,7 +650,17 @@ void loop_normal_mode() {
   }
     
   // Update the sensors data
-  water_leakage_guard.run();
+  if(water_leakage_guard.run()) {
+    record_flow_sample();
+  }
+
+  // Save the totals when it's due
+  checkpoint_totals(false);
+
+  // Send what was logged while offline
+  if(wifi_connected) {
+    upload_telemetry_log();
+  }
 
   // Check WiFi connection
   check_wifi_connection();
@@ -347,53 +674,334 @@ void loop_normal_mode() {
  * 
  */
 void monitor_water_leakage() {
-  //? UPDATING AVERAGE FLOW VALUE
-  // Get average flow value
-  float current_water_flow_value = water_leakage_guard.get_average_flow_value();
-  Serial.printf("Water Flow: %f litre / minute\n", current_water_flow_value);
-  
-  
-  //? UPDATING WATER LEAK VALUE
-  // Get water leak value
-  int8_t current_water_leak_value = water_leakage_guard.get_water_leak_value();
-  // int8_t current_water_leak_value = random(0, 4);
-  Serial.printf("Water Leak: %d\n", current_water_leak_value);
-  
+  //? UPDATE TO WEB SOCKET (queued while disconnected)
+  // Flow changes are reported by report_flow_changes() as soon as a sample comes in
 
-  if(!wifi_connected) return;
-  //? UPDATE TO WEB SOCKET
-  // If the data changed, update to the websocket
-  if(current_water_flow_value != previous_water_flow_value) {
+  // If the night flow history changed its mind, update to the websocket
+  bool current_background_leak = night_flow_analyzer.has_background_leak();
+  if(current_background_leak != previous_background_leak) {
+
+    #ifdef ENV_BINARY_TELEMETRY
+    bool result = launch_frame(TELEMETRY_FRAME_BACKGROUND_LEAK);
+    #else
+    // Prepare the data for the night minimum flow (mL/min), 0 when the alert clears
+    ws_manager.put("bgleak=");
+    ws_manager.put((int) (current_background_leak ? night_flow_analyzer.get_last_night_minimum() : 0));
 
-    // Prepare the data for flow value
-    ws_manager.put(String("aflow="));
-    ws_manager.put(current_water_flow_value);
-    
     // Send the data
     bool result = ws_manager.launch();
+    #endif
 
-    // Set the previous average water flow value to reduce data sending
-    previous_water_flow_value = current_water_flow_value;
+    if(result) {
+      previous_background_leak = current_background_leak;
+    }
   }
+}
 
-  // If the data changed, update to the websocket
-  if(current_water_leak_value != previous_water_leak_value && current_water_leak_value != -1) {
-  
-    // Prepare the data for flow value
-    ws_manager.put(String("leak="));
-    ws_manager.put(current_water_leak_value);
-  
-    // Send the data
-    bool result = ws_manager.launch();
-    
+/**
+ * @brief Feed the latest sample to the flow analysis and history
+ * @attention This function should be called every time the Water Leakage Guard applies a new sample!
+ * 
+ */
+void record_flow_sample() {
+  night_flow_analyzer.sample(water_leakage_guard.get_inflow_mlpm(), time(nullptr));
+
+  // 64-bit uptime, millis() would wrap after 49.7 days and send the history back in time
+  uint32_t time_s = (uint32_t) (esp_timer_get_time() / 1000000);
+  for(uint8_t sensor_index = 0; sensor_index < WATER_FLOW_SENSOR_COUNT; sensor_index++) {
+    flow_histories[sensor_index].add_sample(time_s, water_leakage_guard.get_flow_rate_mlpm(sensor_index));
+  }
+
+  // Nobody is listening, keep it for later
+  if(!ws_manager.is_connected()) {
+    log_telemetry_record();
+  }
+
+  report_flow_changes();
+}
+
+/**
+ * @brief Send a snapshot when the flow of any sensor is worth reporting
+ * @details Every sensor has its own deadband, heartbeat and rate of change trigger (see configure_report_policies).
+ *          The snapshot carries every sensor, so every policy starts over from it.
+ * 
+ */
+void report_flow_changes() {
+  uint32_t current_time = millis();
+
+  // Every policy has to see every sample for its rate of change
+  bool report_due = false;
+  for(uint8_t sensor_index = 0; sensor_index < WATER_FLOW_SENSOR_COUNT; sensor_index++) {
+    if(flow_report_policies[sensor_index].sample(water_leakage_guard.get_flow_rate_mlpm(sensor_index), current_time)) {
+      report_due = true;
+    }
+  }
+
+  if(!report_due || !launch_snapshot()) return;
+
+  for(uint8_t sensor_index = 0; sensor_index < WATER_FLOW_SENSOR_COUNT; sensor_index++) {
+    flow_report_policies[sensor_index].reported(water_leakage_guard.get_flow_rate_mlpm(sensor_index), current_time);
+  }
+}
+
+/**
+ * @brief Set how flow changes are reported
+ * @param max_interval_ms heartbeat, a snapshot is sent at least this often
+ * 
+ */
+void configure_report_policies(uint32_t max_interval_ms) {
+  ReportPolicyConfig config;
+  config.absolute_deadband = REPORT_FLOW_DEADBAND_MLPM;
+  config.relative_deadband = REPORT_FLOW_DEADBAND_RELATIVE;
+  config.min_interval_ms = REPORT_MIN_INTERVAL_MS;
+  config.max_interval_ms = max_interval_ms;
+  config.rate_of_change = REPORT_FLOW_RATE_OF_CHANGE;
+
+  for(ReportPolicy &policy : flow_report_policies) {
+    policy.configure(config);
+  }
+}
+
+/**
+ * @brief Append the latest sample frame to the telemetry log
+ * 
+ */
+void log_telemetry_record() {
+  const SampleFrame &frame = water_leakage_guard.get_last_frame();
+
+  TelemetryRecord record = {};
+  record.timestamp = get_timestamp();
+  record.leaking_segments = water_leakage_guard.get_leaking_segments();
+  record.sensor_count = min(frame.sensor_count, (uint8_t) TELEMETRY_LOG_MAX_SENSORS);
+  for(uint8_t index = 0; index < record.sensor_count; index++) {
+    record.pulses[index] = frame.pulses[index];
+  }
+
+  telemetry_log.append(record);
+}
+
+/**
+ * @brief Upload the telemetry log one page at a time
+ * @details The next page is sent when the server acknowledges the previous one with "logack=<sequence>",
+ *          or again after INTERVAL_TELEMETRY_UPLOAD if it didn't.
+ * 
+ */
+void upload_telemetry_log() {
+  if(!ws_manager.is_connected()) return;
+
+  // Close the page written while offline
+  telemetry_log.seal();
+  if(!telemetry_log.has_backlog()) return;
+
+  if(telemetry_upload_waiting && millis() - last_telemetry_upload < INTERVAL_TELEMETRY_UPLOAD) return;
+
+  uint32_t sequence = 0;
+  size_t length = telemetry_log.read_batch(telemetry_batch, sizeof(telemetry_batch), sequence);
+  if(length == 0) return;
+
+  const uint8_t *batch = telemetry_batch;
+
+  #ifdef ENV_COMPRESSED_TELEMETRY_LOG
+  #ifdef SHOW_DEBUG
+  uint32_t compress_start = micros();
+  #endif
+
+  size_t compressed_length = TelemetryLog::compress_batch(telemetry_batch, length, compressed_telemetry_batch, sizeof(compressed_telemetry_batch));
+
+  #ifdef SHOW_DEBUG
+  Serial.printf("[MAIN] Compressed log page #%u from %u to %u bytes in %u us\n", sequence, length, compressed_length, micros() - compress_start);
+  #endif
+
+  // Sent as it is when compressing doesn't make it smaller
+  if(compressed_length > 0) {
+    batch = compressed_telemetry_batch;
+    length = compressed_length;
+  }
+  #endif
+
+  #ifdef SHOW_INFO
+  Serial.printf("[MAIN] Uploading telemetry log page #%u\n", sequence);
+  #endif
+
+  ws_manager.launch(batch, length);
+  telemetry_upload_waiting = true;
+  last_telemetry_upload = millis();
+}
+
+/**
+ * @brief Leak state listener
+ * @details Called by the Water Leakage Guard in the same sample the leak state of a pipe segment changes.
+ *          Turns the buzzer on when a leak is confirmed and off when it's cleared, then sends the leak value.
+ * 
+ */
+void on_leak_state_changed(uint8_t segment_index, LeakState previous_state, LeakState state) {
+  if(state == LEAK_STATE_CONFIRMED) {
     // Send warning to the current leakage sensor (turn on buzzer)
-    water_leakage_guard.set_warning(current_water_leak_value-1, 1);
-    
-    // Set the previous water leak value to reduce data sending
-    previous_water_leak_value = current_water_leak_value;
+    water_leakage_guard.set_warning(segment_index, 1);
+  }
+  else if(state == LEAK_STATE_CLEARED) {
+    water_leakage_guard.set_warning(segment_index, 0);
+  }
+  else {
+    // Suspected or back to normal, nothing to tell yet
+    return;
+  }
+
+  // Alarms are numbered and resent until the server acknowledges them, even across reconnections
+  #ifdef ENV_BINARY_TELEMETRY
+  // Send the state of every segment
+  launch_frame(TELEMETRY_FRAME_LEAK);
+  #else
+  // Prepare the data for leak value (first leaking sensor, 0 when every leak is cleared)
+  ws_manager.put("leak=");
+  ws_manager.put(water_leakage_guard.get_water_leak_value());
+
+  // Send the data
+  ws_manager.launch(WS_PRIORITY_ALARM);
+  #endif
+}
+
+/**
+ * @brief Send a binary telemetry frame with the current values
+ * @param kind what to send, the values are filled in from the Water Leakage Guard and the night flow analysis
+ * 
+ */
+bool launch_frame(TelemetryFrameKind kind) {
+  TelemetryFrame frame = {};
+  frame.kind = kind;
+  frame.timestamp = get_timestamp();
+
+  uint8_t sensor_count = min(water_leakage_guard.get_sensor_count(), (uint8_t) TELEMETRY_FRAME_MAX_VALUES);
+  switch (kind) {
+    case TELEMETRY_FRAME_FLOW:
+      frame.value_count = sensor_count;
+      for(uint8_t index = 0; index < sensor_count; index++) {
+        frame.values[index] = water_leakage_guard.get_flow_rate_mlpm(index);
+      }
+      break;
+
+    case TELEMETRY_FRAME_LEAK:
+      frame.value_count = sensor_count;
+      for(uint8_t index = 0; index < sensor_count; index++) {
+        frame.values[index] = water_leakage_guard.get_leak_state(index);
+      }
+      break;
+
+    case TELEMETRY_FRAME_BACKGROUND_LEAK:
+      frame.value_count = 1;
+      frame.values[0] = night_flow_analyzer.has_background_leak() ? night_flow_analyzer.get_last_night_minimum() : 0;
+      break;
+
+    case TELEMETRY_FRAME_SNAPSHOT: {
+      GuardSnapshot snapshot;
+      water_leakage_guard.get_snapshot(snapshot);
+
+      sensor_count = min(snapshot.sensor_count, (uint8_t) (TELEMETRY_FRAME_MAX_VALUES / TELEMETRY_FRAME_SNAPSHOT_VALUES));
+      frame.value_count = sensor_count * TELEMETRY_FRAME_SNAPSHOT_VALUES;
+      for(uint8_t index = 0; index < sensor_count; index++) {
+        // Totals are 64-bit, sent as low and high halves
+        uint32_t *values = frame.values + index * TELEMETRY_FRAME_SNAPSHOT_VALUES;
+        values[0] = snapshot.sensors[index].flow_rate_mlpm;
+        values[1] = (uint32_t) snapshot.sensors[index].total_millilitres;
+        values[2] = (uint32_t) (snapshot.sensors[index].total_millilitres >> 32);
+        values[3] = (uint32_t) snapshot.sensors[index].total_pulses;
+        values[4] = (uint32_t) (snapshot.sensors[index].total_pulses >> 32);
+        values[5] = snapshot.sensors[index].leak_state;
+      }
+      break;
+    }
+  }
+
+  return ws_manager.launch(frame, kind == TELEMETRY_FRAME_LEAK ? WS_PRIORITY_ALARM : WS_PRIORITY_NORMAL);
+}
+
+/**
+ * @brief Send rate, volume, pulses and leak state of every sensor as one message
+ * @details Text layout is "snap=<flow>,<volume>,<pulses>,<leak state>;..." with one group per sensor,
+ *          flow in mL/min and volume in mL.
+ * 
+ */
+bool launch_snapshot() {
+  #ifdef ENV_BINARY_TELEMETRY
+  return launch_frame(TELEMETRY_FRAME_SNAPSHOT);
+  #else
+  GuardSnapshot snapshot;
+  water_leakage_guard.get_snapshot(snapshot);
+
+  ws_manager.put("snap=");
+  for(uint8_t index = 0; index < snapshot.sensor_count; index++) {
+    const SensorSnapshot &sensor = snapshot.sensors[index];
+    if(index > 0) ws_manager.put(';');
+
+    ws_manager.put(sensor.flow_rate_mlpm);
+    ws_manager.put(',');
+    ws_manager.put(sensor.total_millilitres);
+    ws_manager.put(',');
+    ws_manager.put(sensor.total_pulses);
+    ws_manager.put(',');
+    ws_manager.put((uint8_t) sensor.leak_state);
+  }
+
+  return ws_manager.launch();
+  #endif
+}
+
+/**
+ * @brief Get the time to stamp telemetry with
+ * @return Unix time if the clock is set, otherwise seconds since boot
+ * 
+ */
+uint32_t get_timestamp() {
+  time_t now = time(nullptr);
+  return now >= MIN_VALID_TIME ? (uint32_t) now : (uint32_t) (esp_timer_get_time() / 1000000);
+}
+
+/**
+ * @brief Restore flow sensor totals from the newest checkpoint
+ * @attention This function should be called after adding sensors and setting calibration!
+ * 
+ */
+void restore_totals() {
+  uint64_t total_pulses[TOTALIZER_STORE_MAX_SENSORS];
+  uint64_t total_millilitres[TOTALIZER_STORE_MAX_SENSORS];
+  uint8_t sensor_count = totalizer_store.restore(total_pulses, total_millilitres);
+
+  for(uint8_t index = 0; index < sensor_count && index < water_leakage_guard.get_sensor_count(); index++) {
+    water_leakage_guard.restore_totals(index, total_pulses[index], total_millilitres[index]);
   }
 }
 
+/**
+ * @brief Save flow sensor totals to flash
+ * @param force save now instead of waiting for the next due checkpoint
+ * 
+ */
+void checkpoint_totals(bool force) {
+  uint64_t total_pulses[TOTALIZER_STORE_MAX_SENSORS];
+  uint64_t total_millilitres[TOTALIZER_STORE_MAX_SENSORS];
+  uint8_t sensor_count = min(water_leakage_guard.get_sensor_count(), (uint8_t) TOTALIZER_STORE_MAX_SENSORS);
+
+  for(uint8_t index = 0; index < sensor_count; index++) {
+    total_pulses[index] = water_leakage_guard.get_total_pulses(index);
+    total_millilitres[index] = water_leakage_guard.get_total_millilitres(index);
+  }
+
+  totalizer_store.checkpoint(total_pulses, total_millilitres, sensor_count, force);
+}
+
+
+/**
+ * @brief Progress callback of the updater, the first call of an upload starts it
+ * @note Called with 0 bytes before the first block is written to flash
+ */
+void on_ota_update(size_t current, size_t final) {
+  if(!ota_in_progress) {
+    ota_in_progress = true;
+    on_ota_start();
+  }
+
+  on_ota_progress(current, final);
+}
 
 /**
  * @brief On OTA firmware update start
@@ -401,6 +1009,8 @@ void monitor_water_leakage() {
  */
 void on_ota_start() {
   Serial.print("[OTA] Begin to upgrade firmware\n");
+  checkpoint_totals(true);
+  telemetry_log.flush();
 }
 
 /**
@@ -0,0 +1,135 @@
+#include <NightFlowAnalyzer.h>
+#include <Arduino.h>
+#include <env.h>
+
+// Anything before 2020 means the clock isn't set yet
+#define NIGHT_FLOW_MIN_VALID_TIME 1577836800
+
+
+void NightFlowAnalyzer::configure(uint16_t start_minute, uint16_t end_minute, float trend_mlpm_per_day, uint32_t background_mlpm) {
+  this->start_minute = start_minute % (24 * 60);
+  this->end_minute = end_minute % (24 * 60);
+  this->trend_threshold = trend_mlpm_per_day;
+  this->background_threshold = background_mlpm;
+}
+
+void NightFlowAnalyzer::sample(uint32_t flow_mlpm, time_t now) {
+  if(now < NIGHT_FLOW_MIN_VALID_TIME) return;
+
+  // Local time only changes what we do once per minute
+  time_t epoch_minute = now / 60;
+  if(epoch_minute != this->current_epoch_minute) {
+    this->close_minute();
+    this->current_epoch_minute = epoch_minute;
+
+    struct tm local_time;
+    localtime_r(&now, &local_time);
+    bool in_window = this->is_in_window(local_time.tm_hour * 60 + local_time.tm_min);
+
+    if(this->in_window && !in_window) this->close_night();
+    if(!this->in_window && in_window) this->night_minimum = UINT32_MAX;
+    this->in_window = in_window;
+  }
+
+  if(!this->in_window) return;
+
+  this->minute_sum += flow_mlpm;
+  this->minute_samples++;
+}
+
+bool NightFlowAnalyzer::is_in_window(uint16_t minute_of_day) const {
+  if(this->start_minute <= this->end_minute) {
+    return minute_of_day >= this->start_minute && minute_of_day < this->end_minute;
+  }
+
+  // Window crossing midnight
+  return minute_of_day >= this->start_minute || minute_of_day < this->end_minute;
+}
+
+void NightFlowAnalyzer::close_minute() {
+  // The quietest full minute is the sustained minimum, short bursts can't pull it up
+  if(this->in_window && this->minute_samples >= NIGHT_FLOW_MIN_SAMPLES_PER_MINUTE) {
+    uint32_t average = this->minute_sum / this->minute_samples;
+    if(average < this->night_minimum) this->night_minimum = average;
+  }
+
+  this->minute_sum = 0;
+  this->minute_samples = 0;
+}
+
+void NightFlowAnalyzer::close_night() {
+  // Device was off or the clock jumped, nothing measured
+  if(this->night_minimum == UINT32_MAX) return;
+
+  this->history[this->history_head] = this->night_minimum;
+  this->history_head = (this->history_head + 1) % NIGHT_FLOW_HISTORY_DAYS;
+  if(this->history_count < NIGHT_FLOW_HISTORY_DAYS) this->history_count++;
+
+  #ifdef SHOW_INFO
+  Serial.printf("[NightFlow] Night minimum: %u mL/min\n", this->night_minimum);
+  #endif
+
+  this->evaluate();
+}
+
+void NightFlowAnalyzer::evaluate() {
+  uint32_t nights[NIGHT_FLOW_HISTORY_DAYS];
+  uint8_t count = this->get_history(nights, NIGHT_FLOW_HISTORY_DAYS);
+
+  this->trend = 0;
+  this->background_leak = false;
+  if(count < NIGHT_FLOW_MIN_NIGHTS) return;
+
+  // Least squares slope of the night minimum against the night number
+  float mean_x = (count - 1) / 2.0f;
+  float mean_y = 0;
+  for(uint8_t index = 0; index < count; index++) mean_y += nights[index];
+  mean_y /= count;
+
+  float covariance = 0;
+  float variance = 0;
+  for(uint8_t index = 0; index < count; index++) {
+    covariance += (index - mean_x) * (nights[index] - mean_y);
+    variance += (index - mean_x) * (index - mean_x);
+  }
+  this->trend = covariance / variance;
+
+  // Water never stopped for the latest nights
+  bool never_stopped = true;
+  for(uint8_t index = count - NIGHT_FLOW_MIN_NIGHTS; index < count; index++) {
+    if(nights[index] < this->background_threshold) never_stopped = false;
+  }
+
+  this->background_leak = this->trend >= this->trend_threshold || never_stopped;
+
+  #ifdef SHOW_WARN
+  if(this->background_leak) {
+    Serial.printf("[NightFlow] Background leak suspected! trend: %.1f mL/min per day\n", this->trend);
+  }
+  #endif
+}
+
+bool NightFlowAnalyzer::has_background_leak() const {
+  return this->background_leak;
+}
+
+uint32_t NightFlowAnalyzer::get_last_night_minimum() const {
+  if(this->history_count == 0) return 0;
+
+  return this->history[(this->history_head + NIGHT_FLOW_HISTORY_DAYS - 1) % NIGHT_FLOW_HISTORY_DAYS];
+}
+
+float NightFlowAnalyzer::get_trend() const {
+  return this->trend;
+}
+
+uint8_t NightFlowAnalyzer::get_history(uint32_t *night_minimums, uint8_t max_nights) const {
+  uint8_t count = this->history_count < max_nights ? this->history_count : max_nights;
+  uint8_t start = (this->history_head + NIGHT_FLOW_HISTORY_DAYS - count) % NIGHT_FLOW_HISTORY_DAYS;
+
+  for(uint8_t index = 0; index < count; index++) {
+    night_minimums[index] = this->history[(start + index) % NIGHT_FLOW_HISTORY_DAYS];
+  }
+
+  return count;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+
+// Default quiet window, from 02:00 to 04:00 local time (minutes since midnight)
+#define NIGHT_FLOW_DEFAULT_START_MINUTE (2 * 60)
+#define NIGHT_FLOW_DEFAULT_END_MINUTE (4 * 60)
+
+// Number of nights kept in history
+#define NIGHT_FLOW_HISTORY_DAYS 14
+
+// A minute only counts when at least this many samples (one per second) landed in it
+#define NIGHT_FLOW_MIN_SAMPLES_PER_MINUTE 45
+
+// Nights needed before raising an alert
+#define NIGHT_FLOW_MIN_NIGHTS 5
+
+// Alert when the night minimum grows by this much per day (mL/min per day)...
+#define NIGHT_FLOW_DEFAULT_TREND_MLPM_PER_DAY 10.0f
+
+// ...or when it never went below this for the last NIGHT_FLOW_MIN_NIGHTS nights (30 mL/min ~ 43 L/day)
+#define NIGHT_FLOW_DEFAULT_BACKGROUND_MLPM 30
+
+/**
+ * @brief Minimum night flow analysis for slow background leaks
+ * @details During the quiet window the flow is averaged per minute and the quietest minute of the night is kept.
+ *          Every night's minimum goes into a fixed history, and a rising trend (least squares slope) or a minimum
+ *          that never drops to zero raises a background leak alert.
+ *          Memory is constant and a sample costs a few additions, local time is only computed once per minute.
+ * @attention The clock must be set (NTP), samples are ignored until it is
+ * 
+ * example usage:
+ * @code
+ * NightFlowAnalyzer night_flow_analyzer;
+ * 
+ * void loop() {
+ *  if(water_leakage_guard.run()) {
+ *    night_flow_analyzer.sample(water_leakage_guard.get_inflow_mlpm(), time(nullptr));
+ *  }
+ * 
+ *  if(night_flow_analyzer.has_background_leak()) {
+ *    Serial.printf("Background leak, %u mL/min at night\n", night_flow_analyzer.get_last_night_minimum());
+ *  }
+ * }
+ * @endcode
+ */
+class NightFlowAnalyzer
+{
+public:
+  /**
+   * @brief Used to set the quiet window and alert thresholds
+   * @param start_minute start of the window in minutes since midnight (local time)
+   * @param end_minute end of the window in minutes since midnight, may be before start_minute to cross midnight
+   */
+  void configure(uint16_t start_minute, uint16_t end_minute,
+                 float trend_mlpm_per_day = NIGHT_FLOW_DEFAULT_TREND_MLPM_PER_DAY,
+                 uint32_t background_mlpm = NIGHT_FLOW_DEFAULT_BACKGROUND_MLPM);
+
+  /**
+   * @brief Used to add one flow sample, expected once per second
+   * @param flow_mlpm flow going into the installation in millilitres per minute
+   * @param now current time from time()
+   */
+  void sample(uint32_t flow_mlpm, time_t now);
+
+  /**
+   * @brief Check if the night history points to a background leak
+   */
+  bool has_background_leak() const;
+
+  /**
+   * @brief Get minimum sustained flow of the latest complete night in millilitres per minute
+   */
+  uint32_t get_last_night_minimum() const;
+
+  /**
+   * @brief Get growth of the night minimum in millilitres per minute per day
+   */
+  float get_trend() const;
+
+  /**
+   * @brief Used to copy night minimums, oldest first
+   * @return number of nights copied
+   */
+  uint8_t get_history(uint32_t *night_minimums, uint8_t max_nights) const;
+
+private:
+  uint16_t start_minute = NIGHT_FLOW_DEFAULT_START_MINUTE;
+  uint16_t end_minute = NIGHT_FLOW_DEFAULT_END_MINUTE;
+  float trend_threshold = NIGHT_FLOW_DEFAULT_TREND_MLPM_PER_DAY;
+  uint32_t background_threshold = NIGHT_FLOW_DEFAULT_BACKGROUND_MLPM;
+
+  // Current minute
+  time_t current_epoch_minute = 0;
+  bool in_window = false;
+  uint64_t minute_sum = 0;
+  uint16_t minute_samples = 0;
+
+  // Current night
+  uint32_t night_minimum = UINT32_MAX;
+
+  // History of night minimums
+  uint32_t history[NIGHT_FLOW_HISTORY_DAYS] = {};
+  uint8_t history_head = 0;
+  uint8_t history_count = 0;
+  float trend = 0;
+  bool background_leak = false;
+
+  bool is_in_window(uint16_t minute_of_day) const;
+  void close_minute();
+  void close_night();
+  void evaluate();
+};
@@ -0,0 +1,52 @@
+#include <ReportPolicy.h>
+#include <Arduino.h>
+
+
+void ReportPolicy::configure(const ReportPolicyConfig &config) {
+  this->config = config;
+}
+
+const ReportPolicyConfig &ReportPolicy::get_config() const {
+  return this->config;
+}
+
+bool ReportPolicy::sample(int32_t value, uint32_t current_time) {
+  //? Rate of change, compared with the previous sample
+  bool fast_change = false;
+  if(this->has_sample && this->config.rate_of_change > 0 && current_time != this->last_sample_time) {
+    uint64_t change = (uint64_t) llabs((int64_t) value - this->last_sample_value);
+    uint64_t change_per_second = change * 1000ULL / (current_time - this->last_sample_time);
+    fast_change = change_per_second >= this->config.rate_of_change;
+  }
+
+  this->has_sample = true;
+  this->last_sample_value = value;
+  this->last_sample_time = current_time;
+
+  if(!this->has_reported || fast_change) return true;
+
+  //? Heartbeat
+  uint32_t elapsed = current_time - this->last_reported_time;
+  if(this->config.max_interval_ms > 0 && elapsed >= this->config.max_interval_ms) return true;
+
+  //? Deadband, around the last reported value
+  if(elapsed < this->config.min_interval_ms) return false;
+
+  uint64_t change = (uint64_t) llabs((int64_t) value - this->last_reported_value);
+  uint64_t deadband = this->config.absolute_deadband;
+  uint64_t relative_deadband = (uint64_t) (this->config.relative_deadband * llabs(this->last_reported_value));
+  if(relative_deadband > deadband) deadband = relative_deadband;
+
+  // Without any deadband every change counts
+  return deadband == 0 ? change > 0 : change >= deadband;
+}
+
+void ReportPolicy::reported(int32_t value, uint32_t current_time) {
+  this->has_reported = true;
+  this->last_reported_value = value;
+  this->last_reported_time = current_time;
+}
+
+void ReportPolicy::reset() {
+  this->has_reported = false;
+}
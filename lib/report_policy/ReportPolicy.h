@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * @brief When a metric is worth reporting
+ * @note Any field set to 0 turns that rule off
+ */
+struct ReportPolicyConfig
+{
+  uint32_t absolute_deadband = 0;   // Change from the last reported value that is worth a report, in metric units
+  float relative_deadband = 0.0f;   // Same as a fraction of the last reported value, the larger deadband wins
+  uint32_t min_interval_ms = 0;     // No deadband report closer than this to the previous one
+  uint32_t max_interval_ms = 0;     // Report at least this often even when nothing changed (heartbeat)
+  uint32_t rate_of_change = 0;      // Change per second between two samples that is reported at once, even within min_interval_ms
+};
+
+/**
+ * @brief Decide when a metric has to be reported, instead of reporting every sample
+ * @details A sample is reported when it left the deadband around the last reported value (and the
+ *          minimum interval passed), when it moved faster than the rate of change trigger, or when the
+ *          heartbeat is due. The first sample is always reported.
+ * 
+ * example usage:
+ * @code
+ * ReportPolicyConfig config;
+ * config.absolute_deadband = 100;  // 0.1 L/min
+ * config.relative_deadband = 0.05; // or 5%
+ * config.max_interval_ms = 60000;  // at least once a minute
+ * 
+ * ReportPolicy flow_policy;
+ * flow_policy.configure(config);
+ * 
+ * void loop() {
+ *  uint32_t flow = water_leakage_guard.get_flow_rate_mlpm(0);
+ *  if(flow_policy.sample(flow, millis())) {
+ *    send(flow);
+ *    flow_policy.reported(flow, millis());
+ *  }
+ * }
+ * @endcode
+ */
+class ReportPolicy
+{
+public:
+  /**
+   * @brief Set the rules of the policy
+   */
+  void configure(const ReportPolicyConfig &config);
+
+  /**
+   * @brief Get the rules of the policy
+   */
+  const ReportPolicyConfig &get_config() const;
+
+  /**
+   * @brief Feed a new sample of the metric
+   * @return true if it should be reported, call reported() once it is
+   */
+  bool sample(int32_t value, uint32_t current_time);
+
+  /**
+   * @brief Mark a value as reported, the deadband and intervals start from it
+   * @note Also call it when the value went out with another metric's report
+   */
+  void reported(int32_t value, uint32_t current_time);
+
+  /**
+   * @brief Report the next sample whatever its value
+   */
+  void reset();
+
+private:
+  ReportPolicyConfig config;
+
+  bool has_reported = false;
+  int32_t last_reported_value = 0;
+  uint32_t last_reported_time = 0;
+
+  bool has_sample = false;
+  int32_t last_sample_value = 0;
+  uint32_t last_sample_time = 0;
+};
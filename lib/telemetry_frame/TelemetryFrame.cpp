@@ -0,0 +1,60 @@
+#include <TelemetryFrame.h>
+
+//? Little endian helpers, independent of the host byte order
+static void write_u32(uint8_t *buffer, uint32_t value) {
+  buffer[0] = value;
+  buffer[1] = value >> 8;
+  buffer[2] = value >> 16;
+  buffer[3] = value >> 24;
+}
+
+static uint32_t read_u32(const uint8_t *buffer) {
+  return (uint32_t) buffer[0]
+    | ((uint32_t) buffer[1] << 8)
+    | ((uint32_t) buffer[2] << 16)
+    | ((uint32_t) buffer[3] << 24);
+}
+
+
+size_t TelemetryFrame::get_size() const {
+  return TELEMETRY_FRAME_HEADER_SIZE + 4 * (size_t) this->value_count;
+}
+
+size_t TelemetryFrame::encode(uint8_t *buffer, size_t capacity) const {
+  if(this->value_count > TELEMETRY_FRAME_MAX_VALUES) return 0;
+
+  size_t size = this->get_size();
+  if(size > capacity) return 0;
+
+  buffer[0] = TELEMETRY_FRAME_VERSION;
+  buffer[1] = this->kind;
+  write_u32(buffer + 2, this->sequence);
+  write_u32(buffer + 6, this->timestamp);
+  buffer[10] = this->value_count;
+
+  for(uint8_t index = 0; index < this->value_count; index++) {
+    write_u32(buffer + TELEMETRY_FRAME_HEADER_SIZE + 4 * index, this->values[index]);
+  }
+
+  return size;
+}
+
+bool TelemetryFrame::decode(const uint8_t *buffer, size_t length) {
+  if(length < TELEMETRY_FRAME_HEADER_SIZE) return false;
+  if(buffer[0] != TELEMETRY_FRAME_VERSION) return false;
+
+  uint8_t value_count = buffer[10];
+  if(value_count > TELEMETRY_FRAME_MAX_VALUES) return false;
+  if(length != TELEMETRY_FRAME_HEADER_SIZE + 4 * (size_t) value_count) return false;
+
+  this->kind = buffer[1];
+  this->sequence = read_u32(buffer + 2);
+  this->timestamp = read_u32(buffer + 6);
+  this->value_count = value_count;
+
+  for(uint8_t index = 0; index < value_count; index++) {
+    this->values[index] = read_u32(buffer + TELEMETRY_FRAME_HEADER_SIZE + 4 * index);
+  }
+
+  return true;
+}
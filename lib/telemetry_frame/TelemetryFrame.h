@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Bumped whenever the layout changes, the decoder rejects any other version
+#define TELEMETRY_FRAME_VERSION 2
+
+// Version, kind, sequence, timestamp and value count in front of the values
+#define TELEMETRY_FRAME_HEADER_SIZE 11
+
+// Enough for a snapshot of 4 sensors
+#define TELEMETRY_FRAME_MAX_VALUES 24
+
+// Values per sensor in a snapshot frame
+#define TELEMETRY_FRAME_SNAPSHOT_VALUES 6
+
+// A buffer this big always fits a frame
+#define TELEMETRY_FRAME_MAX_SIZE (TELEMETRY_FRAME_HEADER_SIZE + 4 * TELEMETRY_FRAME_MAX_VALUES)
+
+/**
+ * @brief What the values of a frame mean
+ */
+enum TelemetryFrameKind : uint8_t
+{
+  TELEMETRY_FRAME_FLOW = 1,             // Flow of every sensor, mL/min
+  TELEMETRY_FRAME_LEAK = 2,             // Leak state of every pipe segment (LeakState)
+  TELEMETRY_FRAME_BACKGROUND_LEAK = 3,  // Night minimum flow in mL/min, 0 when the alert clears
+  TELEMETRY_FRAME_SNAPSHOT = 4,         // Every sensor in turn: flow (mL/min), volume (mL) low and high 32 bits,
+                                        // pulses low and high 32 bits, leak state
+};
+
+/**
+ * @brief Binary telemetry message, sent with sendBIN instead of "key=value" text
+ * @details Plain C++ with no Arduino dependency, so the server side or a host tool can build it as is.
+ * 
+ * Layout (little endian):
+ * | version (1) | kind (1) | sequence (4) | timestamp (4) | value count (1) | values (4 * value count) |
+ * 
+ * Size against the text protocol, 2 sensors:
+ * - text "aflow=12.34" is 11 bytes for the average alone, with no sequence, time or per-sensor flow.
+ *   Adding them ("seq=1234&ts=1760000000&f1=6170&f2=6170") takes about 40 bytes.
+ * - binary flow frame is 19 bytes with all of them, and costs no String allocation or float formatting.
+ * 
+ * example usage:
+ * @code
+ * TelemetryFrame frame = {};
+ * frame.kind = TELEMETRY_FRAME_FLOW;
+ * frame.timestamp = time(nullptr);
+ * frame.value_count = 2;
+ * frame.values[0] = 6170;
+ * frame.values[1] = 6170;
+ * 
+ * ws_manager.launch(frame); // Fills in the sequence number
+ * 
+ * // On the receiving side
+ * TelemetryFrame received;
+ * if(received.decode(data, length)) { ... }
+ * @endcode
+ */
+struct TelemetryFrame
+{
+  uint8_t kind;
+  uint32_t sequence;
+  uint32_t timestamp;   // Unix time if the clock is set, otherwise seconds since boot
+  uint8_t value_count;
+  uint32_t values[TELEMETRY_FRAME_MAX_VALUES];
+
+  /**
+   * @brief Get the number of bytes encode() writes
+   */
+  size_t get_size() const;
+
+  /**
+   * @brief Write the frame into a buffer
+   * @return frame length, 0 if the buffer is too small or there are too many values
+   */
+  size_t encode(uint8_t *buffer, size_t capacity) const;
+
+  /**
+   * @brief Read a frame from a buffer
+   * @return false if the version is unknown or the length doesn't match
+   */
+  bool decode(const uint8_t *buffer, size_t length);
+};
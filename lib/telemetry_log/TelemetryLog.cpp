@@ -0,0 +1,289 @@
+#include <TelemetryLog.h>
+#include <HistoryCodec.h>
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <esp32/rom/crc.h>
+#include <env.h>
+
+// Marks a written page, anything else in a slot is an empty or foreign page
+#define TELEMETRY_LOG_PAGE_MAGIC 0x474C5754UL
+
+// Length and CRC-8 in front of every record
+#define TELEMETRY_LOG_RECORD_HEADER_SIZE 2
+
+
+bool TelemetryLog::begin() {
+  this->mounted = LittleFS.begin(true);
+  if(!this->mounted) {
+    #ifdef SHOW_WARN
+    Serial.println("[TelemetryLog] Failed to mount LittleFS");
+    #endif
+    return false;
+  }
+
+  // Newest page in the file, the next one goes after it
+  uint32_t newest_sequence = 0;
+  File file = LittleFS.open(TELEMETRY_LOG_PATH, "r");
+  if(file) {
+    for(uint32_t slot = 0; slot < TELEMETRY_LOG_PAGES; slot++) {
+      PageHeader page_header;
+      if(!file.seek(slot * TELEMETRY_LOG_PAGE_SIZE)) break;
+      if(file.read((uint8_t *) &page_header, sizeof(PageHeader)) != sizeof(PageHeader)) break;
+      if(page_header.magic != TELEMETRY_LOG_PAGE_MAGIC) continue;
+      if(page_header.sequence > newest_sequence) newest_sequence = page_header.sequence;
+    }
+    file.close();
+  }
+
+  File ack_file = LittleFS.open(TELEMETRY_LOG_ACK_PATH, "r");
+  if(ack_file) {
+    if(ack_file.read((uint8_t *) &this->acked_sequence, sizeof(uint32_t)) != sizeof(uint32_t)) {
+      this->acked_sequence = 0;
+    }
+    ack_file.close();
+  }
+
+  // The log was wiped but the acknowledgement wasn't
+  if(this->acked_sequence > newest_sequence) this->acked_sequence = newest_sequence;
+
+  this->start_page(newest_sequence + 1);
+  this->last_flush_time = millis();
+
+  #ifdef SHOW_INFO
+  Serial.printf("[TelemetryLog] Newest page #%u, uploaded up to #%u\n", newest_sequence, this->acked_sequence);
+  #endif
+
+  return true;
+}
+
+//? Writing
+bool TelemetryLog::append(const TelemetryRecord &record) {
+  if(!this->mounted) return false;
+
+  uint8_t sensor_count = min(record.sensor_count, (uint8_t) TELEMETRY_LOG_MAX_SENSORS);
+  uint8_t length = 9 + 4 * sensor_count;
+
+  // Page is full, write it and continue in the next one
+  if((size_t) this->header.used_bytes + TELEMETRY_LOG_RECORD_HEADER_SIZE + length > RECORDS_SIZE) {
+    if(!this->write_page()) return false;
+    this->start_page(this->header.sequence + 1);
+  }
+
+  uint8_t *data = this->records + this->header.used_bytes;
+  uint8_t *payload = data + TELEMETRY_LOG_RECORD_HEADER_SIZE;
+
+  memcpy(payload, &record.timestamp, 4);
+  memcpy(payload + 4, &record.leaking_segments, 4);
+  payload[8] = sensor_count;
+  memcpy(payload + 9, record.pulses, 4 * sensor_count);
+
+  data[0] = length;
+  data[1] = crc8_le(0, payload, length);
+
+  this->header.used_bytes += TELEMETRY_LOG_RECORD_HEADER_SIZE + length;
+  this->header.record_count++;
+  this->page_dirty = true;
+
+  if(millis() - this->last_flush_time >= TELEMETRY_LOG_FLUSH_INTERVAL_MS) {
+    return this->flush();
+  }
+
+  return true;
+}
+
+bool TelemetryLog::flush() {
+  this->last_flush_time = millis();
+  if(!this->page_dirty) return true;
+
+  return this->write_page();
+}
+
+bool TelemetryLog::seal() {
+  if(this->header.record_count == 0) return true;
+  if(!this->flush()) return false;
+
+  this->start_page(this->header.sequence + 1);
+  return true;
+}
+
+void TelemetryLog::start_page(uint32_t sequence) {
+  this->header = {};
+  this->header.magic = TELEMETRY_LOG_PAGE_MAGIC;
+  this->header.sequence = sequence;
+  this->page_dirty = false;
+}
+
+bool TelemetryLog::write_page() {
+  // "r+" can't create the file, the first page ever needs "w"
+  const char *mode = LittleFS.exists(TELEMETRY_LOG_PATH) ? "r+" : "w";
+  File file = LittleFS.open(TELEMETRY_LOG_PATH, mode);
+  if(!file) {
+    #ifdef SHOW_WARN
+    Serial.println("[TelemetryLog] Failed to open the log file");
+    #endif
+    return false;
+  }
+
+  this->header.crc = TelemetryLog::get_crc(this->header, this->records);
+
+  // Seeking past the end fills the gap with zeros, so slots are in place from the start
+  uint32_t slot = this->header.sequence % TELEMETRY_LOG_PAGES;
+  bool written = file.seek(slot * TELEMETRY_LOG_PAGE_SIZE)
+    && file.write((const uint8_t *) &this->header, sizeof(PageHeader)) == sizeof(PageHeader)
+    && file.write(this->records, this->header.used_bytes) == this->header.used_bytes;
+  file.close();
+
+  if(!written) {
+    #ifdef SHOW_WARN
+    Serial.printf("[TelemetryLog] Failed to write page #%u\n", this->header.sequence);
+    #endif
+    return false;
+  }
+
+  this->page_dirty = false;
+  return true;
+}
+
+
+
+//? Uploading
+bool TelemetryLog::has_backlog() {
+  return this->mounted && this->get_oldest_unacked_sequence() < this->header.sequence;
+}
+
+size_t TelemetryLog::read_batch(uint8_t *buffer, size_t capacity, uint32_t &sequence) {
+  if(!this->mounted || capacity <= TELEMETRY_LOG_BATCH_HEADER_SIZE) return 0;
+
+  // The open page isn't uploaded until it's sealed
+  for(sequence = this->get_oldest_unacked_sequence(); sequence < this->header.sequence; sequence++) {
+    PageHeader page_header;
+    if(!this->read_header(sequence, page_header)) continue;
+
+    uint16_t record_count = 0;
+    size_t length = this->read_records(page_header, buffer + TELEMETRY_LOG_BATCH_HEADER_SIZE, capacity - TELEMETRY_LOG_BATCH_HEADER_SIZE, record_count);
+    if(record_count == 0) continue;
+
+    buffer[0] = TELEMETRY_LOG_BATCH_KIND;
+    memcpy(buffer + 1, &sequence, 4);
+    memcpy(buffer + 5, &record_count, 2);
+    return TELEMETRY_LOG_BATCH_HEADER_SIZE + length;
+  }
+
+  return 0;
+}
+
+size_t TelemetryLog::compress_batch(const uint8_t *batch, size_t length, uint8_t *buffer, size_t capacity) {
+  if(length < TELEMETRY_LOG_BATCH_HEADER_SIZE + TELEMETRY_LOG_RECORD_HEADER_SIZE + 9) return 0;
+
+  // Never send a compressed batch that isn't smaller
+  if(capacity >= length) capacity = length - 1;
+  if(capacity <= TELEMETRY_LOG_BATCH_HEADER_SIZE) return 0;
+
+  // Every record must have the sensor count of the first one
+  uint8_t sensor_count = batch[TELEMETRY_LOG_BATCH_HEADER_SIZE + TELEMETRY_LOG_RECORD_HEADER_SIZE + 8];
+  if(sensor_count > TELEMETRY_LOG_MAX_SENSORS) return 0;
+
+  HistoryEncoder encoder;
+  if(!encoder.begin(buffer + TELEMETRY_LOG_BATCH_HEADER_SIZE, capacity - TELEMETRY_LOG_BATCH_HEADER_SIZE, 1 + sensor_count)) return 0;
+
+  size_t offset = TELEMETRY_LOG_BATCH_HEADER_SIZE;
+  while(offset + TELEMETRY_LOG_RECORD_HEADER_SIZE <= length) {
+    const uint8_t *payload = batch + offset + TELEMETRY_LOG_RECORD_HEADER_SIZE;
+    uint8_t record_length = batch[offset];
+    if(record_length != 9 + 4 * sensor_count || payload[8] != sensor_count) return 0;
+
+    uint32_t timestamp;
+    uint32_t values[1 + TELEMETRY_LOG_MAX_SENSORS];
+    memcpy(&timestamp, payload, 4);
+    memcpy(values, payload + 4, 4);
+    memcpy(values + 1, payload + 9, 4 * sensor_count);
+    if(!encoder.add(timestamp, values)) return 0;
+
+    offset += TELEMETRY_LOG_RECORD_HEADER_SIZE + record_length;
+  }
+
+  // Same header, sequence and record count stay as they are
+  buffer[0] = TELEMETRY_LOG_COMPRESSED_BATCH_KIND;
+  memcpy(buffer + 1, batch + 1, TELEMETRY_LOG_BATCH_HEADER_SIZE - 1);
+  return TELEMETRY_LOG_BATCH_HEADER_SIZE + encoder.finish();
+}
+
+bool TelemetryLog::acknowledge(uint32_t sequence) {
+  if(!this->mounted) return false;
+
+  // Only sealed pages can be acknowledged
+  if(sequence >= this->header.sequence) sequence = this->header.sequence - 1;
+  if(sequence <= this->acked_sequence) return true;
+
+  File ack_file = LittleFS.open(TELEMETRY_LOG_ACK_PATH, "w");
+  if(!ack_file) return false;
+
+  bool written = ack_file.write((const uint8_t *) &sequence, sizeof(uint32_t)) == sizeof(uint32_t);
+  ack_file.close();
+
+  if(written) this->acked_sequence = sequence;
+  return written;
+}
+
+uint32_t TelemetryLog::get_oldest_unacked_sequence() {
+  // Pages older than the log size were overwritten by the open page and the ones before it
+  uint32_t oldest_kept = this->header.sequence > TELEMETRY_LOG_PAGES ? this->header.sequence - TELEMETRY_LOG_PAGES + 1 : 1;
+  return max(this->acked_sequence + 1, oldest_kept);
+}
+
+bool TelemetryLog::read_header(uint32_t sequence, PageHeader &page_header) {
+  File file = LittleFS.open(TELEMETRY_LOG_PATH, "r");
+  if(!file) return false;
+
+  uint32_t slot = sequence % TELEMETRY_LOG_PAGES;
+  bool found = file.seek(slot * TELEMETRY_LOG_PAGE_SIZE)
+    && file.read((uint8_t *) &page_header, sizeof(PageHeader)) == sizeof(PageHeader);
+  file.close();
+
+  return found
+    && page_header.magic == TELEMETRY_LOG_PAGE_MAGIC
+    && page_header.sequence == sequence
+    && page_header.used_bytes <= RECORDS_SIZE;
+}
+
+size_t TelemetryLog::read_records(const PageHeader &page_header, uint8_t *data, size_t capacity, uint16_t &record_count) {
+  record_count = 0;
+  if(page_header.used_bytes > capacity) return 0;
+
+  File file = LittleFS.open(TELEMETRY_LOG_PATH, "r");
+  if(!file) return 0;
+
+  uint32_t slot = page_header.sequence % TELEMETRY_LOG_PAGES;
+  size_t length = 0;
+  if(file.seek(slot * TELEMETRY_LOG_PAGE_SIZE + sizeof(PageHeader))) {
+    length = file.read(data, page_header.used_bytes);
+  }
+  file.close();
+
+  if(length == page_header.used_bytes && page_header.crc == TelemetryLog::get_crc(page_header, data)) {
+    record_count = page_header.record_count;
+    return length;
+  }
+
+  // Torn page, keep the records up to the first broken one
+  size_t offset = 0;
+  while(offset + TELEMETRY_LOG_RECORD_HEADER_SIZE <= length) {
+    uint8_t record_length = data[offset];
+    if(record_length < 9 || offset + TELEMETRY_LOG_RECORD_HEADER_SIZE + record_length > length) break;
+    if(data[offset + 1] != crc8_le(0, data + offset + TELEMETRY_LOG_RECORD_HEADER_SIZE, record_length)) break;
+
+    offset += TELEMETRY_LOG_RECORD_HEADER_SIZE + record_length;
+    record_count++;
+  }
+
+  #ifdef SHOW_WARN
+  Serial.printf("[TelemetryLog] Page #%u is damaged, salvaged %u of %u records\n", page_header.sequence, record_count, page_header.record_count);
+  #endif
+
+  return offset;
+}
+
+uint32_t TelemetryLog::get_crc(const PageHeader &page_header, const uint8_t *records) {
+  uint32_t crc = crc32_le(0, (const uint8_t *) &page_header, offsetof(PageHeader, crc));
+  return crc32_le(crc, records, page_header.used_bytes);
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Log file on the LittleFS partition
+#define TELEMETRY_LOG_PATH "/telemetry.log"
+#define TELEMETRY_LOG_ACK_PATH "/telemetry.ack"
+
+// One page is written at a time, the log keeps the latest TELEMETRY_LOG_PAGES pages (256 KB)
+#define TELEMETRY_LOG_PAGE_SIZE 4096
+#define TELEMETRY_LOG_PAGES 64
+
+// The page in RAM is written to flash at least this often, a crash loses at most this much
+#define TELEMETRY_LOG_FLUSH_INTERVAL_MS 60000UL
+
+// Number of sensors a record can hold
+#define TELEMETRY_LOG_MAX_SENSORS 4
+
+// First byte of an uploaded batch ('L')
+#define TELEMETRY_LOG_BATCH_KIND 0x4C
+
+// First byte of a compressed batch ('H'), the records are a HistoryCodec stream
+#define TELEMETRY_LOG_COMPRESSED_BATCH_KIND 0x48
+
+// Kind, page sequence and record count in front of the records of a batch
+#define TELEMETRY_LOG_BATCH_HEADER_SIZE 7
+
+// A buffer this big always fits a whole page batch
+#define TELEMETRY_LOG_BATCH_MAX_SIZE (TELEMETRY_LOG_PAGE_SIZE + TELEMETRY_LOG_BATCH_HEADER_SIZE)
+
+/**
+ * @brief One sample of every sensor
+ */
+struct TelemetryRecord
+{
+  uint32_t timestamp;         // Unix time if the clock is set, otherwise seconds since boot
+  uint32_t leaking_segments;  // Bit N set when segment N has a confirmed leak
+  uint8_t sensor_count;
+  uint32_t pulses[TELEMETRY_LOG_MAX_SENSORS];
+};
+
+/**
+ * @brief Flash-backed circular log of telemetry records for offline periods
+ * @details Records are packed into a page in RAM, every record framed by its length and a CRC-8.
+ *          A page is written as a whole to its slot in a fixed size file with a header holding a
+ *          sequence number and a CRC-32 of the page. A torn page loses only the records after the first
+ *          broken one. Uploaded pages are acknowledged by sequence number, kept in a separate file.
+ * 
+ * Uploaded batch layout (little endian):
+ * | kind (1) | page sequence (4) | record count (2) | records... |
+ * Record layout:
+ * | length (1) | crc-8 (1) | timestamp (4) | leaking segments (4) | sensor count (1) | pulses (4 * sensor count) |
+ * A compressed batch has the same header with its own kind, followed by a HistoryCodec stream with
+ * the leaking segments as the first channel and the pulses of every sensor after it.
+ * 
+ * example usage:
+ * @code
+ * TelemetryLog telemetry_log;
+ * 
+ * void loop() {
+ *  if(!ws_manager.is_connected()) telemetry_log.append(record);
+ * 
+ *  uint32_t sequence;
+ *  size_t length = telemetry_log.read_batch(buffer, sizeof(buffer), sequence);
+ *  if(length > 0) ws_manager.launch(buffer, length); // Server replies with "logack=<sequence>"
+ * }
+ * @endcode
+ */
+class TelemetryLog
+{
+public:
+  /**
+   * @brief Mount the file system and find the newest page
+   */
+  bool begin();
+
+  /**
+   * @brief Add a record to the page in RAM, the page is written when it's full or due
+   */
+  bool append(const TelemetryRecord &record);
+
+  /**
+   * @brief Write the page in RAM to flash, it stays open for more records
+   */
+  bool flush();
+
+  /**
+   * @brief Write the page in RAM to flash and start a new one, so it can be uploaded
+   */
+  bool seal();
+
+  /**
+   * @brief Check if there are pages waiting for upload
+   */
+  bool has_backlog();
+
+  /**
+   * @brief Copy the oldest page that isn't acknowledged into an upload batch
+   * @param sequence is filled with the page sequence, to acknowledge it later
+   * @return batch length, 0 if there's nothing to upload or the buffer is too small
+   */
+  size_t read_batch(uint8_t *buffer, size_t capacity, uint32_t &sequence);
+
+  /**
+   * @brief Re-encode a batch from read_batch() with HistoryCodec
+   * @return compressed batch length, 0 if it isn't smaller than the batch or the records don't share a sensor count
+   */
+  static size_t compress_batch(const uint8_t *batch, size_t length, uint8_t *buffer, size_t capacity);
+
+  /**
+   * @brief Mark every page up to sequence as uploaded
+   */
+  bool acknowledge(uint32_t sequence);
+
+private:
+  struct PageHeader
+  {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t used_bytes;
+    uint16_t record_count;
+    uint32_t crc;
+  };
+
+  static constexpr size_t RECORDS_SIZE = TELEMETRY_LOG_PAGE_SIZE - sizeof(PageHeader);
+
+  bool mounted = false;
+  PageHeader header = {};
+  uint8_t records[RECORDS_SIZE];
+  bool page_dirty = false;
+  uint64_t last_flush_time = 0;
+  uint32_t acked_sequence = 0;
+
+  bool write_page();
+  void start_page(uint32_t sequence);
+  bool read_header(uint32_t sequence, PageHeader &page_header);
+  size_t read_records(const PageHeader &page_header, uint8_t *data, size_t capacity, uint16_t &record_count);
+  uint32_t get_oldest_unacked_sequence();
+  static uint32_t get_crc(const PageHeader &page_header, const uint8_t *records);
+};
@@ -0,0 +1,108 @@
+#include <TotalizerStore.h>
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp32/rom/crc.h>
+#include <env.h>
+
+// Checkpoints have their own namespace, away from the configuration
+static Preferences totalizer_preferences;
+
+
+uint8_t TotalizerStore::restore(uint64_t *total_pulses, uint64_t *total_millilitres) {
+  totalizer_preferences.begin("wms-tz", true);
+
+  bool found = false;
+  for(uint8_t slot = 0; slot < TOTALIZER_STORE_SLOTS; slot++) {
+    Record record;
+    String key = "tz-" + String(slot);
+
+    if(totalizer_preferences.getBytes(key.c_str(), &record, sizeof(Record)) != sizeof(Record)) continue;
+    if(record.crc != TotalizerStore::get_crc(record)) continue;
+    if(record.sensor_count > TOTALIZER_STORE_MAX_SENSORS) continue;
+
+    // Newest record wins, the one after it is the next to be overwritten
+    if(!found || (int32_t) (record.sequence - this->last_record.sequence) > 0) {
+      this->last_record = record;
+      this->next_slot = (slot + 1) % TOTALIZER_STORE_SLOTS;
+      found = true;
+    }
+  }
+
+  totalizer_preferences.end();
+  this->last_checkpoint_time = millis();
+
+  if(!found) {
+    #ifdef SHOW_INFO
+    Serial.println("[TotalizerStore] No checkpoint found, starting from zero");
+    #endif
+    return 0;
+  }
+
+  for(uint8_t index = 0; index < this->last_record.sensor_count; index++) {
+    total_pulses[index] = this->last_record.total_pulses[index];
+    total_millilitres[index] = this->last_record.total_millilitres[index];
+  }
+
+  #ifdef SHOW_INFO
+  Serial.printf("[TotalizerStore] Restored checkpoint #%u\n", this->last_record.sequence);
+  #endif
+
+  return this->last_record.sensor_count;
+}
+
+bool TotalizerStore::checkpoint(const uint64_t *total_pulses, const uint64_t *total_millilitres, uint8_t sensor_count, bool force) {
+  if(sensor_count > TOTALIZER_STORE_MAX_SENSORS) sensor_count = TOTALIZER_STORE_MAX_SENSORS;
+
+  // Find how far the totals moved since the last checkpoint
+  bool changed = sensor_count != this->last_record.sensor_count;
+  uint64_t largest_delta = 0;
+  for(uint8_t index = 0; index < sensor_count; index++) {
+    if(total_pulses[index] != this->last_record.total_pulses[index]) changed = true;
+
+    uint64_t delta = total_millilitres[index] - this->last_record.total_millilitres[index];
+    if(delta > largest_delta) largest_delta = delta;
+  }
+
+  if(!changed) return false;
+
+  bool volume_due = largest_delta >= TOTALIZER_CHECKPOINT_MILLILITRES;
+  bool time_due = millis() - this->last_checkpoint_time >= TOTALIZER_CHECKPOINT_INTERVAL_MS;
+  if(!force && !volume_due && !time_due) return false;
+
+  Record record = {};
+  record.sequence = this->last_record.sequence + 1;
+  record.sensor_count = sensor_count;
+  for(uint8_t index = 0; index < sensor_count; index++) {
+    record.total_pulses[index] = total_pulses[index];
+    record.total_millilitres[index] = total_millilitres[index];
+  }
+  record.crc = TotalizerStore::get_crc(record);
+
+  String key = "tz-" + String(this->next_slot);
+
+  totalizer_preferences.begin("wms-tz", false);
+  size_t length = totalizer_preferences.putBytes(key.c_str(), &record, sizeof(Record));
+  totalizer_preferences.end();
+
+  this->last_checkpoint_time = millis();
+
+  if(length != sizeof(Record)) {
+    #ifdef SHOW_WARN
+    Serial.println("[TotalizerStore] Failed to write checkpoint!");
+    #endif
+    return false;
+  }
+
+  this->last_record = record;
+  this->next_slot = (this->next_slot + 1) % TOTALIZER_STORE_SLOTS;
+
+  #ifdef SHOW_DEBUG
+  Serial.printf("[TotalizerStore] Checkpoint #%u saved\n", record.sequence);
+  #endif
+
+  return true;
+}
+
+uint32_t TotalizerStore::get_crc(const Record &record) {
+  return crc32_le(0, (const uint8_t *) &record, offsetof(Record, crc));
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Number of round-robin record slots in flash
+#define TOTALIZER_STORE_SLOTS 8
+
+// Number of sensors a record can hold
+#define TOTALIZER_STORE_MAX_SENSORS 4
+
+// Save when any sensor counted this much volume since the last checkpoint...
+#define TOTALIZER_CHECKPOINT_MILLILITRES 10000ULL
+
+// ...or when this much time passed and anything changed, whichever comes first
+#define TOTALIZER_CHECKPOINT_INTERVAL_MS (15UL * 60UL * 1000UL)
+
+/**
+ * @brief Journaled checkpoints of the flow sensor totals in flash
+ * @details Every checkpoint goes to the next slot in round-robin order with an increasing sequence number
+ *          and a CRC, so flash wear is spread and a torn write only loses that one record.
+ *          On boot the valid record with the highest sequence number wins.
+ * 
+ * example usage:
+ * @code
+ * TotalizerStore totalizer_store;
+ * 
+ * void setup() {
+ *  uint64_t pulses[TOTALIZER_STORE_MAX_SENSORS];
+ *  uint64_t millilitres[TOTALIZER_STORE_MAX_SENSORS];
+ *  uint8_t sensor_count = totalizer_store.restore(pulses, millilitres);
+ * }
+ * 
+ * void loop() {
+ *  totalizer_store.checkpoint(pulses, millilitres, sensor_count); // Only writes when it's due
+ * }
+ * @endcode
+ */
+class TotalizerStore
+{
+public:
+  /**
+   * @brief Load the newest valid checkpoint
+   * @param total_pulses is filled with the pulse total of every sensor
+   * @param total_millilitres is filled with the volume total of every sensor
+   * @return number of sensors in the checkpoint, 0 if there's no valid checkpoint
+   */
+  uint8_t restore(uint64_t *total_pulses, uint64_t *total_millilitres);
+
+  /**
+   * @brief Save the totals if a checkpoint is due
+   * @param force save right away if anything changed (before OTA update or reboot)
+   * @return true if a checkpoint was written
+   */
+  bool checkpoint(const uint64_t *total_pulses, const uint64_t *total_millilitres, uint8_t sensor_count, bool force = false);
+
+private:
+  struct Record
+  {
+    uint32_t sequence;
+    uint8_t sensor_count;
+    uint64_t total_pulses[TOTALIZER_STORE_MAX_SENSORS];
+    uint64_t total_millilitres[TOTALIZER_STORE_MAX_SENSORS];
+    uint32_t crc;
+  };
+
+  Record last_record = {};
+  uint8_t next_slot = 0;
+  uint64_t last_checkpoint_time = 0;
+
+  static uint32_t get_crc(const Record &record);
+};
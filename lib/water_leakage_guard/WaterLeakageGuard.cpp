@@ -2,16 +2,152 @@
 #include <Arduino.h>
 #include <env.h>
 
-void WaterLeakageGuard::add_sensor(uint8_t sensor_pin, uint8_t buzzer_pin) {
-  this->flow_sensors.push_back(FlowSensor(sensor_pin, buzzer_pin, 7.5));
+bool WaterLeakageGuard::add_sensor(uint8_t sensor_pin, uint8_t buzzer_pin, PulseCounter *counter) {
+  if(this->sensor_count >= WLG_MAX_SENSORS) {
+    #ifdef SHOW_WARN
+    Serial.println("[WaterLeakageGuard] No more room for flow sensors, increase WLG_MAX_SENSORS!");
+    #endif
+    return false;
+  }
+
+  uint8_t sensor_index = this->sensor_count;
+
+  // Use the reserved counter when no counting backend is given
+  if(counter == nullptr) {
+    #ifdef FLOW_SENSOR_USE_PCNT
+    this->pulse_counters[sensor_index] = PcntPulseCounter(sensor_pin, (pcnt_unit_t) sensor_index);
+    #else
+    this->pulse_counters[sensor_index] = InterruptPulseCounter(sensor_pin);
+    #endif
+    counter = &this->pulse_counters[sensor_index];
+  }
+
+  this->flow_sensors[sensor_index].begin(sensor_pin, buzzer_pin, FLOW_SENSOR_DEFAULT_CALIBRATION_FACTOR, counter);
+
+  // Chain after the previous sensor until told otherwise
+  this->upstream_sensors[sensor_index] = sensor_index == 0 ? WLG_NO_UPSTREAM : sensor_index - 1;
+
+  portENTER_CRITICAL(&pulse_counter_mux);
+  this->sensor_count++;
+  portEXIT_CRITICAL(&pulse_counter_mux);
+
   #ifdef SHOW_INFO
   Serial.println("[WaterLeakageGuard] Successfully added new flow sensor");
   #endif
+  return true;
+}
+
+
+bool WaterLeakageGuard::set_upstream_sensor(uint8_t sensor_index, uint8_t upstream_index) {
+  if(sensor_index >= this->sensor_count) return false;
+  if(upstream_index != WLG_NO_UPSTREAM && upstream_index >= sensor_index) return false;
+
+  uint8_t previous_upstream = this->upstream_sensors[sensor_index];
+  this->upstream_sensors[sensor_index] = upstream_index;
+
+  // The balance of both junctions changed, start them over
+  if(previous_upstream != WLG_NO_UPSTREAM) this->leak_detectors[previous_upstream].reset();
+  if(upstream_index != WLG_NO_UPSTREAM) this->leak_detectors[upstream_index].reset();
+
+  return true;
+}
+
+bool WaterLeakageGuard::begin() {
+  if(this->epoch_timer != nullptr) return true;
+
+  esp_timer_create_args_t timer_args = {};
+  timer_args.callback = WaterLeakageGuard::on_epoch;
+  timer_args.arg = this;
+  timer_args.name = "wlg-epoch";
+
+  if(esp_timer_create(&timer_args, &this->epoch_timer) != ESP_OK) {
+    #ifdef SHOW_WARN
+    Serial.println("[WaterLeakageGuard] Failed to create sampling epoch timer!");
+    #endif
+    this->epoch_timer = nullptr;
+    return false;
+  }
+
+  // Throw away whatever was counted before the first epoch
+  portENTER_CRITICAL(&pulse_counter_mux);
+  for(uint8_t index = 0; index < this->sensor_count; index++) {
+    this->flow_sensors[index].get_counter()->take();
+  }
+  this->last_epoch_time_us = esp_timer_get_time();
+  portEXIT_CRITICAL(&pulse_counter_mux);
+
+  esp_timer_start_periodic(this->epoch_timer, WLG_EPOCH_INTERVAL_MS * 1000ULL);
+
+  #ifdef SHOW_INFO
+  Serial.println("[WaterLeakageGuard] Sampling epochs started");
+  #endif
+  return true;
+}
+
+void WaterLeakageGuard::on_epoch(void *arg) {
+  static_cast<WaterLeakageGuard*>(arg)->capture_frame();
+}
+
+void WaterLeakageGuard::capture_frame() {
+  // Every counter is read while holding the counter lock, so no pulse lands in between
+  portENTER_CRITICAL(&pulse_counter_mux);
+  uint64_t now_us = esp_timer_get_time();
+  uint32_t elapsed_ms = (now_us - this->last_epoch_time_us) / 1000ULL;
+  this->last_epoch_time_us = now_us;
+
+  // If run() didn't take the previous frame yet, extend it instead of losing it
+  if(!this->pending_frame_ready) {
+    this->pending_frame.elapsed_ms = 0;
+    for(uint8_t index = 0; index < WLG_MAX_SENSORS; index++) {
+      this->pending_frame.pulses[index] = 0;
+    }
+  }
+
+  for(uint8_t index = 0; index < this->sensor_count; index++) {
+    this->pending_frame.pulses[index] += this->flow_sensors[index].get_counter()->take();
+  }
+
+  this->pending_frame.sequence = ++this->epoch_sequence;
+  this->pending_frame.timestamp_ms = now_us / 1000ULL;
+  this->pending_frame.elapsed_ms += elapsed_ms;
+  this->pending_frame.sensor_count = this->sensor_count;
+  this->pending_frame_ready = true;
+  portEXIT_CRITICAL(&pulse_counter_mux);
+}
+
+bool WaterLeakageGuard::take_frame(SampleFrame &frame) {
+  portENTER_CRITICAL(&pulse_counter_mux);
+  bool ready = this->pending_frame_ready;
+  if(ready) {
+    frame = this->pending_frame;
+    this->pending_frame_ready = false;
+  }
+  portEXIT_CRITICAL(&pulse_counter_mux);
+
+  return ready;
+}
+
+const SampleFrame &WaterLeakageGuard::get_last_frame() {
+  return this->last_frame;
+}
+
+
+bool WaterLeakageGuard::set_calibration(uint8_t sensor_index, const CalibrationCurve &curve) {
+  if(sensor_index >= this->sensor_count) return false;
+
+  return this->flow_sensors[sensor_index].set_calibration(curve);
+}
+
+
+void WaterLeakageGuard::configure_leak_detection(uint32_t false_alarm_samples, uint32_t noise_floor_mlpm) {
+  for(LeakDetector &leak_detector : this->leak_detectors) {
+    leak_detector.configure(false_alarm_samples, noise_floor_mlpm);
+  }
 }
 
 
 int8_t WaterLeakageGuard::get_water_leak_value() {
-  if(this->flow_sensors.size() < 2) {
+  if(this->sensor_count < 2) {
 
     #ifdef SHOW_WARN
     Serial.println("[WaterLeakageGuard] Number of flow sensors aren't sufficient to perform monitoring!");
@@ -20,62 +156,261 @@ int8_t WaterLeakageGuard::get_water_leak_value() {
     return -1;
   }
 
-  uint8_t current_sensor_index = this->flow_sensors.size() - 1;
+  // Report the first leaking segment from the source
+  for(uint8_t segment_index = 0; segment_index < this->sensor_count; segment_index++) {
+    if(this->leaking_segments & (1UL << segment_index)) {
+      return segment_index + 1;
+    }
+  }
+
+  return 0;
+}
 
-  while(this->is_leaked(this->flow_sensors[0], this->flow_sensors[current_sensor_index])) {
-    current_sensor_index--;
-    if(current_sensor_index <= 0) {
-      break;
+uint32_t WaterLeakageGuard::get_leaking_segments() {
+  return this->leaking_segments;
+}
+
+float WaterLeakageGuard::get_leak_probability(uint8_t segment_index) {
+  if(segment_index >= this->sensor_count) return 0;
+
+  return this->leak_detectors[segment_index].get_leak_probability();
+}
+
+float WaterLeakageGuard::get_leak_rate(uint8_t segment_index) {
+  if(segment_index >= this->sensor_count) return 0;
+
+  return this->leak_detectors[segment_index].get_leak_rate_mlpm() / 1000.0f;
+}
+
+void WaterLeakageGuard::sample_leak_detectors() {
+  // Sum what comes out of every junction in one pass
+  uint32_t outflows_mlpm[WLG_MAX_SENSORS] = {};
+  bool is_junction[WLG_MAX_SENSORS] = {};
+  for(uint8_t index = 0; index < this->sensor_count; index++) {
+    uint8_t upstream_index = this->upstream_sensors[index];
+    if(upstream_index == WLG_NO_UPSTREAM) continue;
+
+    outflows_mlpm[upstream_index] += this->flow_rates_mlpm[index];
+    is_junction[upstream_index] = true;
+  }
+
+  // Mass balance of every junction, inflow must equal the sum of the outflows
+  uint64_t current_time = millis();
+  for(uint8_t index = 0; index < this->sensor_count; index++) {
+    if(!is_junction[index]) {
+      this->update_leak_state(index, 0, current_time);
+      continue;
     }
+
+    this->leak_detectors[index].add_sample(this->flow_rates_mlpm[index], outflows_mlpm[index]);
+    this->update_leak_state(index, this->leak_detectors[index].get_leak_probability(), current_time);
   }
-  
-  return (current_sensor_index == this->flow_sensors.size() - 1) ? 0 : current_sensor_index + 1;
 }
 
-bool WaterLeakageGuard::is_leaked(FlowSensor sensor_1, FlowSensor sensor_2) {
-  float first_flow_rate = sensor_1.get_flow_rate();
-  float second_flow_rate = sensor_2.get_flow_rate();
-  // If there's difference in 10 litres
-  if(second_flow_rate - 10 > first_flow_rate || first_flow_rate > second_flow_rate + 10) {
-    return true;
+void WaterLeakageGuard::update_leak_state(uint8_t segment_index, float probability, uint64_t current_time) {
+  const LeakStateConfig &config = this->leak_state_config;
+  uint64_t &since = this->leak_state_since[segment_index];
+
+  switch(this->leak_states[segment_index]) {
+    case LEAK_STATE_CLEARED:
+      // Cleared only lasts one sample
+      this->set_leak_state(segment_index, LEAK_STATE_NORMAL);
+      // fall through
+
+    case LEAK_STATE_NORMAL:
+      if(probability >= config.suspect_level) {
+        since = 0;
+        this->set_leak_state(segment_index, LEAK_STATE_SUSPECTED);
+      }
+      break;
+
+    case LEAK_STATE_SUSPECTED:
+      if(probability < config.clear_level) {
+        this->set_leak_state(segment_index, LEAK_STATE_NORMAL);
+        break;
+      }
+
+      // Confirm once the evidence stayed at the alarm level for the whole dwell time
+      if(probability < config.confirm_level) {
+        since = 0;
+        break;
+      }
+      if(since == 0) since = current_time;
+      if(current_time - since >= config.confirm_dwell_ms) {
+        since = 0;
+        this->set_leak_state(segment_index, LEAK_STATE_CONFIRMED);
+      }
+      break;
+
+    case LEAK_STATE_CONFIRMED:
+      // Clear once the evidence stayed low for the whole dwell time
+      if(probability >= config.clear_level) {
+        since = 0;
+        break;
+      }
+      if(since == 0) since = current_time;
+      if(current_time - since >= config.clear_dwell_ms) {
+        since = 0;
+        this->set_leak_state(segment_index, LEAK_STATE_CLEARED);
+      }
+      break;
   }
+}
+
+void WaterLeakageGuard::set_leak_state(uint8_t segment_index, LeakState state) {
+  LeakState previous_state = this->leak_states[segment_index];
+  if(previous_state == state) return;
+
+  this->leak_states[segment_index] = state;
+  if(state == LEAK_STATE_CONFIRMED) this->leaking_segments |= 1UL << segment_index;
+  else this->leaking_segments &= ~(1UL << segment_index);
 
+  #ifdef SHOW_INFO
+  Serial.printf("[WaterLeakageGuard] Segment #%d leak state: %d -> %d\n", segment_index + 1, previous_state, state);
+  #endif
+
+  for(LeakStateCallback callback : this->leak_state_callbacks) {
+    if(callback != nullptr) callback(segment_index, previous_state, state);
+  }
+}
+
+LeakState WaterLeakageGuard::get_leak_state(uint8_t segment_index) {
+  if(segment_index >= this->sensor_count) return LEAK_STATE_NORMAL;
+
+  return this->leak_states[segment_index];
+}
+
+void WaterLeakageGuard::configure_leak_states(const LeakStateConfig &config) {
+  this->leak_state_config = config;
+}
+
+bool WaterLeakageGuard::subscribe(LeakStateCallback callback) {
+  for(LeakStateCallback &slot : this->leak_state_callbacks) {
+    if(slot == nullptr) {
+      slot = callback;
+      return true;
+    }
+  }
+
+  #ifdef SHOW_WARN
+  Serial.println("[WaterLeakageGuard] No more room for leak state subscribers!");
+  #endif
   return false;
 }
 
 float WaterLeakageGuard::get_flow_value(uint8_t sensor_index) {
-  if(sensor_index > this->flow_sensors.size()) return -1;
+  if(sensor_index >= this->sensor_count) return -1;
   
-  return this->flow_sensors[sensor_index].get_flow_rate();
+  return this->flow_rates_mlpm[sensor_index] / 1000.0f;
+}
+
+uint32_t WaterLeakageGuard::get_flow_rate_mlpm(uint8_t sensor_index) {
+  if(sensor_index >= this->sensor_count) return 0;
+
+  return this->flow_rates_mlpm[sensor_index];
+}
+
+uint32_t WaterLeakageGuard::get_inflow_mlpm() {
+  uint32_t inflow_mlpm = 0;
+  for(uint8_t index = 0; index < this->sensor_count; index++) {
+    if(this->upstream_sensors[index] == WLG_NO_UPSTREAM) {
+      inflow_mlpm += this->flow_rates_mlpm[index];
+    }
+  }
+
+  return inflow_mlpm;
+}
+
+uint8_t WaterLeakageGuard::get_sensor_count() {
+  return this->sensor_count;
 }
 
-void WaterLeakageGuard::run() {
-  if(this->flow_sensors.size() == 0) return;
+uint64_t WaterLeakageGuard::get_total_pulses(uint8_t sensor_index) {
+  if(sensor_index >= this->sensor_count) return 0;
+
+  return this->flow_sensors[sensor_index].get_total_pulses();
+}
+
+uint64_t WaterLeakageGuard::get_total_millilitres(uint8_t sensor_index) {
+  if(sensor_index >= this->sensor_count) return 0;
+
+  return this->flow_sensors[sensor_index].get_total_millilitres();
+}
+
+void WaterLeakageGuard::get_snapshot(GuardSnapshot &snapshot) {
+  snapshot.timestamp_ms = millis();
+  snapshot.sensor_count = this->sensor_count;
+
+  for(uint8_t index = 0; index < this->sensor_count; index++) {
+    SensorSnapshot &sensor = snapshot.sensors[index];
+    sensor.flow_rate_mlpm = this->flow_rates_mlpm[index];
+    sensor.total_millilitres = this->flow_sensors[index].get_total_millilitres();
+    sensor.total_pulses = this->flow_sensors[index].get_total_pulses();
+    sensor.leak_state = this->leak_states[index];
+  }
+}
+
+void WaterLeakageGuard::restore_totals(uint8_t sensor_index, uint64_t total_pulses, uint64_t total_millilitres) {
+  if(sensor_index >= this->sensor_count) return;
+
+  this->flow_sensors[sensor_index].restore_totals(total_pulses, total_millilitres);
+}
+
+bool WaterLeakageGuard::run() {
+  if(this->sensor_count == 0) return false;
+
+  // Without sampling epochs every sensor keeps its own window
+  if(this->epoch_timer == nullptr) {
+    for(uint8_t index = 0; index < this->sensor_count; index++) {
+      this->flow_sensors[index].update(); // Update all flow sensors
+      this->flow_rates_mlpm[index] = this->flow_sensors[index].get_flow_rate_mlpm();
+    }
+
+    uint64_t current_time = millis();
+    if(current_time - this->last_leak_sample_time < WLG_LEAK_SAMPLE_INTERVAL_MS) return false;
+
+    this->sample_leak_detectors();
+    this->last_leak_sample_time = current_time;
+    return true;
+  }
+
+  bool has_frame = this->take_frame(this->last_frame);
   
-  for(FlowSensor &flow_sensor : flow_sensors) {
-    flow_sensor.update(); // Update all flow sensors
+  for(uint8_t index = 0; index < this->sensor_count; index++) {
+    if(has_frame) {
+      this->flow_sensors[index].update(this->last_frame.pulses[index], this->last_frame.elapsed_ms);
+    }
+    this->flow_sensors[index].refresh();
+    this->flow_rates_mlpm[index] = this->flow_sensors[index].get_flow_rate_mlpm();
+  }
+
+  // Every segment compares windows that line up exactly
+  if(has_frame) {
+    this->sample_leak_detectors();
   }
+
+  return has_frame;
 }
 
 float WaterLeakageGuard::get_average_flow_value() {
-  if(this->flow_sensors.size() == 0) return 0;
+  if(this->sensor_count == 0) return 0;
   
-  float average_flow_sensor = 0;
-  for(FlowSensor &flow_sensor : flow_sensors) {
-    average_flow_sensor += flow_sensor.get_flow_rate();
+  uint64_t total_flow_rate = 0;
+  for(uint8_t index = 0; index < this->sensor_count; index++) {
+    total_flow_rate += this->flow_rates_mlpm[index];
   }
 
-  return average_flow_sensor / this->flow_sensors.size();
+  return total_flow_rate / 1000.0f / this->sensor_count;
 }
 
 void WaterLeakageGuard::set_warning(uint8_t sensor_index, uint8_t value) {
-  if(sensor_index > this->flow_sensors.size()) return;
+  if(sensor_index >= this->sensor_count) return;
 
   this->flow_sensors[sensor_index].buzz(value);
 }
 
 void WaterLeakageGuard::clear_warning() {
-  for(FlowSensor flow_sensor : this->flow_sensors) {
-    flow_sensor.buzz(0);
+  for(uint8_t index = 0; index < this->sensor_count; index++) {
+    this->flow_sensors[index].buzz(0);
   }
 }
\ No newline at end of file
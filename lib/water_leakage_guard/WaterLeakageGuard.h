@@ -6,36 +6,168 @@
 #pragma once
 
 #include <Arduino.h>
-#include <vector>
+#include <esp_timer.h>
 #include <FlowSensor.h>
+#include <PulseCounter.h>
+#include <InterruptPulseCounter.h>
+#include <CalibrationCurve.h>
+#include <LeakDetector.h>
+#include <env.h> // FLOW_SENSOR_USE_PCNT changes the class layout, every includer has to see the same setting
+
+#ifdef FLOW_SENSOR_USE_PCNT
+#include <PcntPulseCounter.h>
+#endif
+
+// Maximum number of flow sensors, storage is reserved up front
+#ifndef WLG_MAX_SENSORS
+#define WLG_MAX_SENSORS 4
+#endif
+
+static_assert(WLG_MAX_SENSORS <= 32, "Leaking segments are reported as a 32-bit mask");
+
+// How often every sensor is sampled, every sampling epoch gives one frame
+#define WLG_EPOCH_INTERVAL_MS 1000
+
+// Upstream index of a sensor right at the water source
+#define WLG_NO_UPSTREAM 0xFF
+
+// How often every pipe segment gets a sample for leak detection when epochs aren't started
+#define WLG_LEAK_SAMPLE_INTERVAL_MS 1000
+
+// Number of leak state subscribers
+#define WLG_MAX_LEAK_SUBSCRIBERS 4
+
+/**
+ * @brief Leak state of a pipe segment
+ */
+enum LeakState : uint8_t
+{
+  LEAK_STATE_NORMAL = 0,
+  LEAK_STATE_SUSPECTED,   // Evidence is building up
+  LEAK_STATE_CONFIRMED,   // Evidence stayed above the alarm level long enough
+  LEAK_STATE_CLEARED,     // Evidence stayed low long enough after a confirmed leak, back to normal next sample
+};
+
+/**
+ * @brief Hysteresis and dwell times of the leak state machine
+ * @note Levels are leak evidence from 0 to 1 (see get_leak_probability)
+ */
+struct LeakStateConfig
+{
+  float suspect_level = 0.5f;       // normal -> suspected when evidence reaches this
+  float confirm_level = 1.0f;       // suspected -> confirmed when evidence stays at this...
+  uint32_t confirm_dwell_ms = 5000; // ...for this long
+  float clear_level = 0.2f;         // suspected -> normal, confirmed -> cleared when evidence stays below this...
+  uint32_t clear_dwell_ms = 30000;  // ...for this long (suspected drops right away)
+};
+
+/**
+ * @brief Called when a pipe segment changes its leak state
+ */
+typedef void (*LeakStateCallback)(uint8_t segment_index, LeakState previous_state, LeakState state);
+
+/**
+ * @brief Pulse counts of every sensor captured at the same instant
+ */
+struct SampleFrame
+{
+  uint32_t sequence;                  // Increases by one every epoch
+  uint32_t timestamp_ms;              // millis() when the frame was closed
+  uint32_t elapsed_ms;                // Length of the frame
+  uint8_t sensor_count;
+  uint32_t pulses[WLG_MAX_SENSORS];   // Pulses of every sensor in the frame
+};
+
+/**
+ * @brief Every metric of one sensor at the same moment
+ */
+struct SensorSnapshot
+{
+  uint32_t flow_rate_mlpm;
+  uint64_t total_millilitres;
+  uint64_t total_pulses;
+  LeakState leak_state;       // Pipe segment after the sensor
+};
+
+/**
+ * @brief Every metric of every sensor, taken in one pass
+ */
+struct GuardSnapshot
+{
+  uint32_t timestamp_ms;      // millis() when the snapshot was taken
+  uint8_t sensor_count;
+  SensorSnapshot sensors[WLG_MAX_SENSORS];
+};
 
 class WaterLeakageGuard
 {
 private:
-  std::vector<FlowSensor> flow_sensors;
+  // Sensors and their default counters live in place, their addresses never change after add_sensor
+  FlowSensor flow_sensors[WLG_MAX_SENSORS];
+  #ifdef FLOW_SENSOR_USE_PCNT
+  PcntPulseCounter pulse_counters[WLG_MAX_SENSORS];
+  #else
+  InterruptPulseCounter pulse_counters[WLG_MAX_SENSORS];
+  #endif
+  uint8_t sensor_count = 0;
+
+  // Hot data of every sensor, refreshed by run()
+  uint32_t flow_rates_mlpm[WLG_MAX_SENSORS] = {};
+
+  // Pipe network, every sensor is fed by its upstream sensor (a tree rooted at the source)
+  uint8_t upstream_sensors[WLG_MAX_SENSORS];
+
+  // One detector per junction, segment N is the pipe from sensor N to every sensor it feeds
+  LeakDetector leak_detectors[WLG_MAX_SENSORS];
+  uint32_t leaking_segments = 0;
+  uint64_t last_leak_sample_time = 0;
+
+  // Leak state machine of every segment
+  LeakStateConfig leak_state_config;
+  LeakState leak_states[WLG_MAX_SENSORS] = {};
+  uint64_t leak_state_since[WLG_MAX_SENSORS] = {};  // When the pending transition condition started, 0 if none
+  LeakStateCallback leak_state_callbacks[WLG_MAX_LEAK_SUBSCRIBERS] = {};
 
   /**
-   * @brief Compare two Flow Sensors to know if there's leakage
-   * @param sensor_1 is a sensor data used for anchor
-   * @param sensor_2 is a sensor data to compare with
-   * 
-   * example usage:
-   * @code
-   * FlowSensor sensor_1 = FlowSensor(3); // Flow sensor in pin 3
-   * FlowSensor sensor_2 = FlowSensor(4); // Flow sensor in pin 4
-   * bool leaked = is_leaked(sensor_1, sensor_2);
-   * if(leaked) {
-   *    Serial.println("There's leakage between sensor 1 and sensor 2")
-   * }
-   * @endcode
+   * @brief Move the leak state of a segment with the latest evidence
+   */
+  void update_leak_state(uint8_t segment_index, float probability, uint64_t current_time);
+  void set_leak_state(uint8_t segment_index, LeakState state);
+
+  // Sampling epochs, the timer closes a frame and run() consumes it
+  esp_timer_handle_t epoch_timer = nullptr;
+  uint64_t last_epoch_time_us = 0;
+  uint32_t epoch_sequence = 0;
+  SampleFrame pending_frame = {};
+  bool pending_frame_ready = false;
+  SampleFrame last_frame = {};
+
+  /**
+   * @brief Snapshot every counter in one critical section and publish it as a frame
+   * @note Runs from the epoch timer
+   */
+  void capture_frame();
+
+  /**
+   * @brief Take the published frame if there's a new one
+   */
+  bool take_frame(SampleFrame &frame);
+
+  static void on_epoch(void *arg);
+
+  /**
+   * @brief Feed every junction with its inflow and the sum of its outflows
    */
-  bool is_leaked(FlowSensor sensor_1, FlowSensor sensor_2);
+  void sample_leak_detectors();
   
 public:
   
   /**
    * @brief Add sensor pin to monitor
    * @param sensor_pin is the pin for water flow sensor to add
+   * @param counter is the pulse counting backend, when not given it uses GPIO interrupts
+   *                (or the PCNT peripheral if FLOW_SENSOR_USE_PCNT is defined)
+   * @return false if there are already WLG_MAX_SENSORS sensors
    * 
    * example usage:
    * @code
@@ -45,11 +177,82 @@ public:
    * }
    * @endcode
    */
-  void add_sensor(uint8_t sensor_pin, uint8_t buzzer_pin);
+  bool add_sensor(uint8_t sensor_pin, uint8_t buzzer_pin, PulseCounter *counter = nullptr);
+
+  /**
+   * @brief Set the sensor feeding water to a sensor
+   * @details Sensors form a chain in the order they're added, this is used for branches.
+   *          Water going into a sensor must come out through every sensor right after it.
+   * @param sensor_index the sensor to connect
+   * @param upstream_index the sensor before it (added earlier), or WLG_NO_UPSTREAM for the source
+   * @return false if the sensors don't exist or upstream_index isn't added before sensor_index
+   * 
+   * example usage:
+   * @code
+   * // Main line (0) feeding floor 1 (1) and floor 2 (2)
+   * water_leakage_guard.add_sensor(4, 5);
+   * water_leakage_guard.add_sensor(2, 17);
+   * water_leakage_guard.add_sensor(15, 16);
+   * water_leakage_guard.set_upstream_sensor(2, 0);
+   * @endcode
+   */
+  bool set_upstream_sensor(uint8_t sensor_index, uint8_t upstream_index);
+
+  /**
+   * @brief Start sampling every sensor at the same instant
+   * @details A timer closes a sampling epoch every WLG_EPOCH_INTERVAL_MS, so upstream and downstream
+   *          flow is compared over exactly the same window.
+   *          Without it every sensor closes its own window in run().
+   * @note Call it after adding every sensor
+   * 
+   * example usage:
+   * @code
+   * void setup() {
+   *  water_leakage_guard.add_sensor(2, 5);
+   *  water_leakage_guard.add_sensor(3, 17);
+   *  water_leakage_guard.begin();
+   * }
+   * @endcode
+   */
+  bool begin();
+
+  /**
+   * @brief Used to get the latest frame consumed by run()
+   */
+  const SampleFrame &get_last_frame();
+
+  /**
+   * @brief Set calibration curve of a sensor
+   * @param sensor_index the sensor in the order it was added
+   * @param curve a constexpr table or a curve loaded from persistence storage
+   * @return false if there's no such sensor or the curve isn't valid
+   * 
+   * example usage:
+   * @code
+   * CalibrationCurve curve;
+   * if(ConfigurationManager::get_calibration(0, curve)) {
+   *  water_leakage_guard.set_calibration(0, curve);
+   * }
+   * @endcode
+   */
+  bool set_calibration(uint8_t sensor_index, const CalibrationCurve &curve);
+
+  /**
+   * @brief Set leak detection sensitivity of every junction
+   * @param false_alarm_samples expected number of samples (one per second) between two false alarms
+   * @param noise_floor_mlpm smallest flow noise assumed in millilitres per minute
+   * 
+   * example usage:
+   * @code
+   * water_leakage_guard.configure_leak_detection(7 * 86400, 100); // One false alarm per week
+   * @endcode
+   */
+  void configure_leak_detection(uint32_t false_alarm_samples, uint32_t noise_floor_mlpm);
   
   /**
    * @brief Used to update the data
    * @note Required to update the data of all sensors
+   * @return true when a new sample (frame) was applied to every sensor
    * 
    * example usage:
    * @code
@@ -61,13 +264,14 @@ public:
    * @endcode
    * 
    */
-  void run();
+  bool run();
   
   /**
    * @brief Monitor for water leakage
    * @attention Required minimal 2 sensors in storage and 2 sensors active
    * @note Use add_sensor function to add sensors
-   * @return Return a sensor number that has leak for the pipe after it
+   * @return Return a sensor number that has a confirmed leak for the pipe after it, 0 if there's no leak
+   * @note Only the first leaking segment, use get_leaking_segments to get all of them
    * 
    * example usage:
    * @code
@@ -88,6 +292,74 @@ public:
    */
   int8_t get_water_leak_value();
 
+  /**
+   * @brief Used to get every leaking segment
+   * @return Bit N is set when the pipe after sensor N has a confirmed leak
+   * 
+   * example usage:
+   * @code
+   * uint32_t leaking_segments = water_leakage_guard.get_leaking_segments();
+   * for(uint8_t index = 0; index < water_leakage_guard.get_sensor_count(); index++) {
+   *  if(leaking_segments & (1UL << index)) {
+   *    Serial.printf("Pipe after sensor #%d has a leak!\n", index + 1);
+   *  }
+   * }
+   * @endcode
+   */
+  uint32_t get_leaking_segments();
+
+  /**
+   * @brief Used to get leak state of a pipe segment
+   * @param segment_index the pipe from sensor segment_index to every sensor it feeds
+   * 
+   */
+  LeakState get_leak_state(uint8_t segment_index);
+
+  /**
+   * @brief Set hysteresis levels and dwell times of the leak state machine
+   * 
+   * example usage:
+   * @code
+   * LeakStateConfig config;
+   * config.confirm_dwell_ms = 10000; // Wait 10 seconds before raising an alarm
+   * water_leakage_guard.configure_leak_states(config);
+   * @endcode
+   */
+  void configure_leak_states(const LeakStateConfig &config);
+
+  /**
+   * @brief Get called whenever a pipe segment changes its leak state
+   * @note Callbacks run inside run(), in the same sample the evidence changes
+   * @return false if there are already WLG_MAX_LEAK_SUBSCRIBERS subscribers
+   * 
+   * example usage:
+   * @code
+   * void on_leak_state(uint8_t segment_index, LeakState previous_state, LeakState state) {
+   *  if(state == LEAK_STATE_CONFIRMED) water_leakage_guard.set_warning(segment_index, 1);
+   *  if(state == LEAK_STATE_CLEARED) water_leakage_guard.set_warning(segment_index, 0);
+   * }
+   * 
+   * void setup() {
+   *  water_leakage_guard.subscribe(on_leak_state);
+   * }
+   * @endcode
+   */
+  bool subscribe(LeakStateCallback callback);
+
+  /**
+   * @brief Used to get leak evidence of a pipe segment from 0 to 1
+   * @param segment_index the pipe from sensor segment_index to every sensor it feeds
+   * 
+   */
+  float get_leak_probability(uint8_t segment_index);
+
+  /**
+   * @brief Used to get estimated leak rate of a pipe segment in litres per minute
+   * @param segment_index the pipe from sensor segment_index to every sensor it feeds
+   * 
+   */
+  float get_leak_rate(uint8_t segment_index);
+
   /**
    * @brief Used to get value
    * @attention Required minimal 1 sensor in storage and 1 sensor active
@@ -105,6 +377,53 @@ public:
    * 
    */
   float get_flow_value(uint8_t sensor_index);
+
+  /**
+   * @brief Used to get flow value of a sensor in millilitres per minute
+   */
+  uint32_t get_flow_rate_mlpm(uint8_t sensor_index);
+
+  /**
+   * @brief Used to get flow going into the installation (every sensor at the source) in millilitres per minute
+   */
+  uint32_t get_inflow_mlpm();
+
+  /**
+   * @brief Used to get number of sensors added
+   */
+  uint8_t get_sensor_count();
+
+  /**
+   * @brief Used to get every pulse counted by a sensor
+   */
+  uint64_t get_total_pulses(uint8_t sensor_index);
+
+  /**
+   * @brief Used to get total volume of a sensor in millilitres
+   */
+  uint64_t get_total_millilitres(uint8_t sensor_index);
+
+  /**
+   * @brief Used to get rate, volume, pulses and leak state of every sensor in one pass
+   * @note Everything comes from the same run(), so the metrics of every sensor line up
+   * 
+   * example usage:
+   * @code
+   * GuardSnapshot snapshot;
+   * water_leakage_guard.get_snapshot(snapshot);
+   * for(uint8_t index = 0; index < snapshot.sensor_count; index++) {
+   *  Serial.printf("Sensor #%d: %u mL/min\n", index + 1, snapshot.sensors[index].flow_rate_mlpm);
+   * }
+   * @endcode
+   */
+  void get_snapshot(GuardSnapshot &snapshot);
+
+  /**
+   * @brief Used to continue counting from saved totals
+   * @note Call it after add_sensor and set_calibration
+   * 
+   */
+  void restore_totals(uint8_t sensor_index, uint64_t total_pulses, uint64_t total_millilitres);
   
   /**
    * @brief Used to update the data
@@ -1,32 +1,31 @@
 #include <WebSocketManager.h>
 #include <env.h>
 
-bool WebSocketManager::init(const char *address, uint16_t port)
-{
-  if(WiFi.status() != WL_CONNECTED)
-  {
+// User listener, gets every event after handle_data
+static void (*data_listener)(WStype_t type, uint8_t * payload, size_t length) = nullptr;
 
-    #ifdef SHOW_WARN
-    Serial.println("[WebSocket] WiFi is not connected");
-    #endif
+// Manager that gets the delivery acknowledgements, handle_data is static for the library
+static WebSocketManager *active_manager = nullptr;
 
-    return false;
-  };
-  
+bool WebSocketManager::init(const char *address, uint16_t port)
+{
   this->address = address;
   this->port = port;
-  
-  #ifdef SHOW_DEBUG
-  Serial.print("[WebSocket] Connecting to: ");
-  Serial.print(address);
-  Serial.print(":");
-  Serial.println(port);
-  #endif
+  active_manager = this;
+
+  // Random start, so the server can tell alarms of this boot from the ones before the reboot
+  this->delivery_sequence = esp_random();
 
   this->web_socket.setExtraHeaders(ENV_COOKIE);
-  this->web_socket.begin(address, port);
   this->web_socket.onEvent(WebSocketManager::handle_data);
 
+  // One connection attempt per CONNECTING state, the backoff decides when the next one is
+  this->web_socket.setReconnectInterval(WS_CONNECT_TIMEOUT_MS);
+
+  // Connection is made by loop() once the WiFi is up
+  this->state = WS_STATE_WIFI_WAIT;
+  this->outage_start_time = millis();
+
   return true;
 }
 
@@ -34,49 +33,17 @@ bool WebSocketManager::init(const char *ssid, const char *pass, const char *addr
 {
   WiFi.begin(ssid, pass);
 
-  if(WiFi.status() != WL_CONNECTED) {
-    
-    #ifdef SHOW_WARN
-    Serial.println("[WebSocket] WiFi is not connected");
-    Serial.println("[WebSocket] Waiting connection to WiFi");
-    #endif
-
-    return false;
-  };
-
-  this->address = address;
-  this->port = port;
-  
-  #ifdef SHOW_DEBUG
-  Serial.print("[WebSocket] Connecting to: ");
-  Serial.print(address);
-  Serial.print(":");
-  Serial.println(port);
-  #endif
-  
-  this->web_socket.setExtraHeaders(ENV_COOKIE);
-  this->web_socket.begin(address, port);
-  this->web_socket.onEvent(WebSocketManager::handle_data);
-  
-  return true;
+  return this->init(address, port);
 }
 
 void WebSocketManager::listen(void (*callback)(WStype_t type, uint8_t * payload, size_t length))
 {
-  if(!this->web_socket.isConnected())
-  {
-    #ifdef SHOW_WARN
-    Serial.println("[WebSocket] WebSocket is not connected!");
-    #endif
-
-    return;
-  }
-
   #ifdef SHOW_INFO
   Serial.println("[WebSocket] Successfully listening to Web Socket server changes!");
   #endif
 
-  this->web_socket.onEvent(callback);
+  // Kept across reconnections, handle_data passes every event on
+  data_listener = callback;
 }
 
 void WebSocketManager::handle_data(WStype_t type, uint8_t * payload, size_t length)
@@ -99,6 +66,11 @@ void WebSocketManager::handle_data(WStype_t type, uint8_t * payload, size_t leng
       #ifdef SHOW_INFO
       Serial.printf("[WebSocket] Message from server: %s\n", payload);
       #endif
+
+      // Server got an alarm, stop resending it
+      if(active_manager != nullptr && length > WS_ACK_PREFIX_LENGTH && memcmp(payload, WS_ACK_PREFIX, WS_ACK_PREFIX_LENGTH) == 0) {
+        active_manager->acknowledge(strtoul((const char *) payload + WS_ACK_PREFIX_LENGTH, nullptr, 10));
+      }
       break;
 
     case WStype_BIN:
@@ -107,23 +79,174 @@ void WebSocketManager::handle_data(WStype_t type, uint8_t * payload, size_t leng
       #endif
       break;
   }
+
+  if(data_listener != nullptr) {
+    data_listener(type, payload, length);
+  }
 }
 
-template bool WebSocketManager::put<int>(const int& data);
-template bool WebSocketManager::put<uint8_t>(const uint8_t& data);
-template bool WebSocketManager::put<int8_t>(const int8_t& data);
-template bool WebSocketManager::put<float>(const float& data);
-template bool WebSocketManager::put<char>(const char& data);
-template bool WebSocketManager::put<String>(const String& data);
+//? Payload Builder
+template <>
+bool WebSocketManager::put<int>(const int& data)
+{
+  return this->append_integer(data < 0 ? 0U - (uint32_t) data : (uint32_t) data, data < 0);
+}
+
+template <>
+bool WebSocketManager::put<uint8_t>(const uint8_t& data)
+{
+  return this->append_integer(data, false);
+}
 
-template <typename T>
-bool WebSocketManager::put(const T& data)
+template <>
+bool WebSocketManager::put<int8_t>(const int8_t& data)
 {
-  this->payload += String(data);
+  return this->append_integer(data < 0 ? -data : data, data < 0);
+}
+
+template <>
+bool WebSocketManager::put<uint32_t>(const uint32_t& data)
+{
+  return this->append_integer(data, false);
+}
+
+template <>
+bool WebSocketManager::put<uint64_t>(const uint64_t& data)
+{
+  return this->append_integer(data, false);
+}
+
+template <>
+bool WebSocketManager::put<float>(const float& data)
+{
+  return this->append_float(data);
+}
+
+template <>
+bool WebSocketManager::put<char>(const char& data)
+{
+  return this->append(&data, 1);
+}
+
+template <>
+bool WebSocketManager::put<String>(const String& data)
+{
+  return this->append(data.c_str(), data.length());
+}
+
+bool WebSocketManager::put(const char *data)
+{
+  return this->append(data, strlen(data));
+}
+
+bool WebSocketManager::append(const char *data, size_t length)
+{
+  if(this->payload_length == 0 && !this->payload_overflow) {
+    this->payload_start_time = micros();
+  }
+
+  if(this->payload_overflow || this->payload_length + length > WS_PAYLOAD_CAPACITY) {
+    this->payload_overflow = true;
+    return false;
+  }
+
+  memcpy(this->payload + this->payload_length, data, length);
+  this->payload_length += length;
   return true;
 }
 
-bool WebSocketManager::launch() {
+bool WebSocketManager::append_integer(uint64_t magnitude, bool negative)
+{
+  char digits[21];
+  uint8_t index = sizeof(digits);
+
+  // 64-bit division is a library call on the ESP32, only the digits above 32 bits use it
+  while(magnitude > UINT32_MAX) {
+    digits[--index] = '0' + magnitude % 10;
+    magnitude /= 10;
+  }
+
+  uint32_t low = (uint32_t) magnitude;
+  do {
+    digits[--index] = '0' + low % 10;
+    low /= 10;
+  } while(low > 0);
+
+  if(negative) digits[--index] = '-';
+
+  return this->append(digits + index, sizeof(digits) - index);
+}
+
+bool WebSocketManager::append_float(float data)
+{
+  if(isnan(data)) return this->append("nan", 3);
+  if(isinf(data)) return data > 0 ? this->append("inf", 3) : this->append("-inf", 4);
+
+  // Same text as String(float), rounded to 2 decimals
+  double magnitude = fabs((double) data);
+  if(magnitude >= 21474836.0) return this->append("ovf", 3);
+
+  uint32_t scaled = (uint32_t) (magnitude * 100.0 + 0.5);
+  char digits[14];
+  uint8_t index = sizeof(digits);
+
+  digits[--index] = '0' + scaled % 10;
+  digits[--index] = '0' + scaled / 10 % 10;
+  digits[--index] = '.';
+
+  uint32_t whole = scaled / 100;
+  do {
+    digits[--index] = '0' + whole % 10;
+    whole /= 10;
+  } while(whole > 0);
+
+  if(data < 0) digits[--index] = '-';
+
+  return this->append(digits + index, sizeof(digits) - index);
+}
+
+void WebSocketManager::reset_payload()
+{
+  this->payload_length = 0;
+  this->payload_overflow = false;
+}
+
+void WebSocketManager::record_send(uint32_t start_time, size_t length)
+{
+  uint32_t elapsed = micros() - start_time;
+
+  this->stats.messages++;
+  this->stats.bytes += length;
+  this->stats.last_us = elapsed;
+  this->stats.total_us += elapsed;
+  if(elapsed > this->stats.max_us) this->stats.max_us = elapsed;
+
+  uint8_t bucket = elapsed < 2 ? 0 : 31 - __builtin_clz(elapsed);
+  if(bucket >= WS_LATENCY_BUCKETS) bucket = WS_LATENCY_BUCKETS - 1;
+  this->stats.latency_histogram[bucket]++;
+}
+
+
+
+//? Sending
+bool WebSocketManager::launch(uint8_t priority) {
+  if(this->payload_overflow) {
+    #ifdef SHOW_WARN
+    Serial.println("[WebSocket] Message is too long, it's not sent!");
+    #endif
+    this->stats.overflows++;
+    this->reset_payload();
+    return false;
+  }
+
+  bool result = this->send(false, (const uint8_t *) this->payload, this->payload_length, priority, this->payload_start_time);
+  this->reset_payload();
+  return result;
+}
+
+bool WebSocketManager::launch(const uint8_t *data, size_t length) {
+  uint32_t start_time = micros();
+
   if (!this->web_socket.isConnected())
   {
     #ifdef SHOW_WARN
@@ -132,38 +255,403 @@ bool WebSocketManager::launch() {
     return false;
   }
 
-  bool result = this->web_socket.sendTXT(this->payload);
-  
+  bool result = this->web_socket.sendBIN(data, length);
+
   #ifdef SHOW_WARN
-  if(result) {
-    Serial.println("[WebSocket] Successfully send data!");
+  if(!result) {
+    Serial.println("[WebSocket] There's an error when trying to send binary data!");
   }
-  else {
+  #endif
+
+  if(result) this->record_send(start_time, length);
+  return result;
+}
+
+bool WebSocketManager::launch(TelemetryFrame &frame, uint8_t priority) {
+  uint32_t start_time = micros();
+  frame.sequence = this->frame_sequence;
+
+  uint8_t buffer[TELEMETRY_FRAME_MAX_SIZE];
+  size_t length = frame.encode(buffer, sizeof(buffer));
+  if(length == 0) {
+    #ifdef SHOW_WARN
+    Serial.println("[WebSocket] Telemetry frame has too many values!");
+    #endif
+    return false;
+  }
+
+  // Sent or queued, every frame takes a number so a gap on the server means a dropped frame
+  this->frame_sequence++;
+  return this->send(true, buffer, length, priority, start_time);
+}
+
+bool WebSocketManager::send(bool binary, const uint8_t *data, size_t length, uint8_t priority, uint32_t start_time) {
+  // Alarms go into the delivery window and are resent until the server acknowledges them
+  if(priority == WS_PRIORITY_ALARM && this->normal_count == this->queue_length && this->add_in_flight(binary, data, length)) {
+    return true;
+  }
+
+  // Anything already queued goes out first to keep the order
+  if(this->queue_length == 0 && this->web_socket.isConnected()) {
+    if(this->transmit(binary, data, length)) {
+      this->record_send(start_time, length);
+      return true;
+    }
+
+    #ifdef SHOW_WARN
     Serial.println("[WebSocket] There's an error when trying to send data!");
+    #endif
+  }
+
+  this->enqueue(binary, data, length, priority);
+  this->flush_queue();
+  return true;
+}
+
+bool WebSocketManager::transmit(bool binary, const uint8_t *data, size_t length) {
+  if(length > WS_BATCH_CAPACITY) return false;
+
+  // The library writes the frame header in front and masks the message in place, so send a copy
+  memcpy(this->batch + WEBSOCKETS_MAX_HEADER_SIZE, data, length);
+  return this->transmit_batch(binary, length);
+}
+
+bool WebSocketManager::transmit_batch(bool binary, size_t length) {
+  return binary
+    ? this->web_socket.sendBIN(this->batch, length, true)
+    : this->web_socket.sendTXT(this->batch, length, true);
+}
+
+
+
+//? Store and Forward Queue
+void WebSocketManager::enqueue(bool binary, const uint8_t *data, size_t length, uint8_t priority) {
+  // Normal messages only get part of the queue, the rest is kept for alarms
+  if(priority == WS_PRIORITY_NORMAL && this->normal_count >= WS_QUEUE_NORMAL_LIMIT) {
+    this->drop_oldest(true);
+  }
+  else if(this->queue_length >= WS_QUEUE_SIZE) {
+    // Only alarms left, a reading never takes the place of an alarm
+    if(priority == WS_PRIORITY_NORMAL && this->normal_count == 0) {
+      #ifdef SHOW_WARN
+      Serial.println("[WebSocket] Queue is full of alarms, dropping the new reading!");
+      #endif
+      this->stats.dropped++;
+      return;
+    }
+
+    this->drop_oldest(this->normal_count > 0);
+  }
+
+  QueuedMessage &message = this->queue[this->queue_length++];
+  message.priority = priority;
+  message.binary = binary;
+  message.length = length;
+  memcpy(message.data, data, length);
+
+  if(priority == WS_PRIORITY_NORMAL) this->normal_count++;
+}
+
+void WebSocketManager::drop_oldest(bool normal_only) {
+  uint8_t index = 0;
+  while(normal_only && this->queue[index].priority != WS_PRIORITY_NORMAL) index++;
+
+  #ifdef SHOW_WARN
+  if(this->queue[index].priority != WS_PRIORITY_NORMAL) {
+    Serial.println("[WebSocket] Queue is full of alarms, dropping the oldest one!");
   }
   #endif
-  
-  this->payload = "";
-  return result;
+
+  if(this->queue[index].priority == WS_PRIORITY_NORMAL) this->normal_count--;
+  this->remove_queued(index, 1);
+  this->stats.dropped++;
 }
 
-void WebSocketManager::wait_to_connect()
-{
-  if(!this->web_socket.isConnected())
-  {
-    #ifdef SHOW_INFO
-    Serial.print("[WebSocket] Connecting to web socket");
+void WebSocketManager::remove_queued(uint8_t index, uint8_t count) {
+  memmove(&this->queue[index], &this->queue[index + count], (this->queue_length - index - count) * sizeof(QueuedMessage));
+  this->queue_length -= count;
+}
+
+void WebSocketManager::flush_queue() {
+  // Alarms at the head of the queue move into the delivery window while there's room
+  while(this->queue_length > 0 && this->queue[0].priority == WS_PRIORITY_ALARM) {
+    const QueuedMessage &message = this->queue[0];
+    if(!this->add_in_flight(message.binary, message.data, message.length)) return;
+
+    this->remove_queued(0, 1);
+  }
+
+  if(this->queue_length == 0 || !this->web_socket.isConnected()) return;
+
+  uint32_t start_time = micros();
+
+  // Coalesce the oldest run of text or binary messages into one frame
+  bool binary = this->queue[0].binary;
+  uint8_t *batch = this->batch + WEBSOCKETS_MAX_HEADER_SIZE;
+  size_t length = binary ? 2 : 0;
+  uint8_t count = 0;
+
+  while(count < this->queue_length && this->queue[count].binary == binary && this->queue[count].priority == WS_PRIORITY_NORMAL) {
+    const QueuedMessage &message = this->queue[count];
+
+    // Binary messages are prefixed by their length, text ones are separated by a new line
+    size_t separator = binary || count > 0 ? 1 : 0;
+    if(length + separator + message.length > WS_BATCH_CAPACITY) break;
+
+    if(binary) batch[length] = message.length;
+    else if(count > 0) batch[length] = '\n';
+    length += separator;
+
+    memcpy(batch + length, message.data, message.length);
+    length += message.length;
+    count++;
+  }
+
+  if(count == 1) {
+    // Nothing to coalesce, send the message as it is
+    memcpy(batch, this->queue[0].data, this->queue[0].length);
+    length = this->queue[0].length;
+  }
+  else if(binary) {
+    batch[0] = WS_BATCH_KIND;
+    batch[1] = count;
+  }
+
+  if(!this->transmit_batch(binary, length)) {
+    #ifdef SHOW_WARN
+    Serial.println("[WebSocket] There's an error when trying to send the queue!");
     #endif
-    while (!this->web_socket.isConnected())
-    {
+    return;
+  }
+
+  #ifdef SHOW_INFO
+  Serial.printf("[WebSocket] Sent %u queued messages in one frame\n", count);
+  #endif
+
+  this->normal_count -= count;
+  this->remove_queued(0, count);
+  this->record_send(start_time, length);
+}
+
+
+
+//? Delivery Window
+bool WebSocketManager::add_in_flight(bool binary, const uint8_t *data, size_t length) {
+  InFlightMessage *message = nullptr;
+  for(InFlightMessage &slot : this->in_flight) {
+    if(!slot.used) {
+      message = &slot;
+      break;
+    }
+  }
+  if(message == nullptr) return false;
+
+  uint32_t sequence = this->delivery_sequence++;
+
+  if(binary) {
+    // 'R', sequence, then the frame
+    message->data[0] = WS_RELIABLE_KIND;
+    message->data[1] = sequence;
+    message->data[2] = sequence >> 8;
+    message->data[3] = sequence >> 16;
+    message->data[4] = sequence >> 24;
+    message->length = 5;
+  }
+  else {
+    // "rel=<sequence>;" then the text
+    char digits[10];
+    uint8_t index = sizeof(digits);
+    uint32_t magnitude = sequence;
+    do {
+      digits[--index] = '0' + magnitude % 10;
+      magnitude /= 10;
+    } while(magnitude > 0);
+
+    memcpy(message->data, WS_RELIABLE_PREFIX, sizeof(WS_RELIABLE_PREFIX) - 1);
+    message->length = sizeof(WS_RELIABLE_PREFIX) - 1;
+    memcpy(message->data + message->length, digits + index, sizeof(digits) - index);
+    message->length += sizeof(digits) - index;
+    message->data[message->length++] = ';';
+  }
+
+  memcpy(message->data + message->length, data, length);
+  message->length += length;
+  message->sequence = sequence;
+  message->binary = binary;
+  message->sent = false;
+  message->used = true;
+
+  // Don't wait for the next loop, alarms are the ones that can't wait
+  this->retransmit(millis());
+  return true;
+}
+
+void WebSocketManager::retransmit(uint32_t current_time) {
+  if(!this->web_socket.isConnected()) return;
+
+  for(InFlightMessage &message : this->in_flight) {
+    if(!message.used) continue;
+    if(message.sent && current_time - message.sent_time < WS_ACK_TIMEOUT_MS) continue;
+
+    uint32_t start_time = micros();
+    if(!this->transmit(message.binary, message.data, message.length)) return;
+
+    if(message.sent) this->stats.retransmits++;
+    else this->record_send(start_time, message.length);
+
+    message.sent = true;
+    message.sent_time = current_time;
+  }
+}
+
+void WebSocketManager::acknowledge(uint32_t sequence) {
+  for(InFlightMessage &message : this->in_flight) {
+    if(!message.used || message.sequence != sequence) continue;
+
+    message.used = false;
+    this->stats.acknowledged++;
+    return;
+  }
+}
+
+
+
+bool WebSocketManager::is_connected() {
+  return this->web_socket.isConnected();
+}
+
+const WebSocketStats &WebSocketManager::get_stats() {
+  return this->stats;
+}
+
+uint32_t WebSocketStats::get_latency_bound(uint8_t percent) const {
+  uint32_t count = 0;
+  for(uint8_t bucket = 0; bucket < WS_LATENCY_BUCKETS; bucket++) count += this->latency_histogram[bucket];
+  if(count == 0) return 0;
+
+  // Rank of the message the percentile falls on, rounded up
+  uint32_t rank = ((uint64_t) count * percent + 99) / 100;
+  if(rank == 0) rank = 1;
+
+  for(uint8_t bucket = 0; bucket < WS_LATENCY_BUCKETS - 1; bucket++) {
+    if(this->latency_histogram[bucket] >= rank) return 2UL << bucket;
+    rank -= this->latency_histogram[bucket];
+  }
+
+  return UINT32_MAX;
+}
+
+//? Connection State Machine
+void WebSocketManager::loop() {
+  if(this->state == WS_STATE_IDLE) return;
+
+  uint32_t current_time = millis();
+
+  // Without WiFi there's nothing to connect to, wait for it from any state
+  if(WiFi.status() != WL_CONNECTED) {
+    if(this->state != WS_STATE_WIFI_WAIT) {
       #ifdef SHOW_INFO
-      Serial.print(" .");
+      Serial.println("[WebSocket] WiFi is not connected, waiting for it");
       #endif
-      delay(500);
+
+      if(this->state == WS_STATE_CONNECTED) this->outage_start_time = current_time;
+      this->web_socket.disconnect();
+      this->state = WS_STATE_WIFI_WAIT;
     }
+    return;
+  }
+
+  switch (this->state) {
+    case WS_STATE_WIFI_WAIT:
+      this->start_connecting(current_time);
+      break;
+
+    case WS_STATE_CONNECTING:
+      this->web_socket.loop();
+
+      if(this->web_socket.isConnected()) {
+        uint32_t latency = current_time - this->outage_start_time;
+        this->stats.reconnects++;
+        this->stats.last_reconnect_ms = latency;
+        if(latency > this->stats.max_reconnect_ms) this->stats.max_reconnect_ms = latency;
+
+        #ifdef SHOW_INFO
+        Serial.printf("[WebSocket] Connected after %u ms and %u attempts\n", latency, this->attempt + 1);
+        #endif
+
+        this->attempt = 0;
+        this->state = WS_STATE_CONNECTED;
+
+        // Whatever was in flight might have been lost with the connection
+        for(InFlightMessage &message : this->in_flight) {
+          message.sent = false;
+        }
+      }
+      else if(current_time - this->state_start_time >= WS_CONNECT_TIMEOUT_MS) {
+        this->start_backoff(current_time);
+      }
+      break;
+
+    case WS_STATE_CONNECTED:
+      this->web_socket.loop();
+
+      if(!this->web_socket.isConnected()) {
+        #ifdef SHOW_INFO
+        Serial.println("[WebSocket] Connection lost");
+        #endif
+
+        this->outage_start_time = current_time;
+        this->start_backoff(current_time);
+        break;
+      }
+
+      // Send what was kept while disconnected, one batch per loop
+      this->flush_queue();
+      this->retransmit(current_time);
+      break;
+
+    case WS_STATE_BACKOFF:
+      if(current_time - this->state_start_time >= this->backoff_delay) {
+        this->start_connecting(current_time);
+      }
+      break;
   }
 }
 
-void WebSocketManager::loop() {
-  this->web_socket.loop();
-}
\ No newline at end of file
+void WebSocketManager::start_connecting(uint32_t current_time) {
+  #ifdef SHOW_DEBUG
+  Serial.print("[WebSocket] Connecting to: ");
+  Serial.print(this->address);
+  Serial.print(":");
+  Serial.println(this->port);
+  #endif
+
+  // begin() clears the library's last failure time, so it tries right away
+  this->web_socket.begin(this->address, this->port);
+  this->stats.attempts++;
+
+  this->state = WS_STATE_CONNECTING;
+  this->state_start_time = current_time;
+}
+
+void WebSocketManager::start_backoff(uint32_t current_time) {
+  this->web_socket.disconnect();
+
+  // Exponential delay, half of it random so devices that lost the server together don't come back together
+  uint32_t backoff = WS_BACKOFF_MAX_MS;
+  if(this->attempt < 16) backoff = min((uint32_t) WS_BACKOFF_BASE_MS << this->attempt, (uint32_t) WS_BACKOFF_MAX_MS);
+  this->backoff_delay = backoff / 2 + esp_random() % (backoff / 2 + 1);
+
+  if(this->attempt < 255) this->attempt++;
+
+  #ifdef SHOW_INFO
+  Serial.printf("[WebSocket] Retrying in %u ms\n", this->backoff_delay);
+  #endif
+
+  this->state = WS_STATE_BACKOFF;
+  this->state_start_time = current_time;
+}
+
+WebSocketState WebSocketManager::get_state() {
+  return this->state;
+}
@@ -3,10 +3,109 @@
 #include <Arduino.h>
 #include <WebSocketsClient.h>
 #include <WiFi.h>
+#include <TelemetryFrame.h>
 
 
 #define WEBSOCKET_DATA WStype_t type, uint8_t * payload, size_t length
 
+// Longest text message put() can build, longer ones are refused instead of growing the buffer
+#define WS_PAYLOAD_CAPACITY 160
+
+// Messages kept while disconnected, the oldest is dropped when it's full
+#define WS_QUEUE_SIZE 16
+
+// Normal messages can only take this many slots, the rest is kept for alarms
+#define WS_QUEUE_NORMAL_LIMIT 12
+
+// Largest frame the queue is coalesced into on reconnect
+#define WS_BATCH_CAPACITY 1024
+
+// First byte of a binary batch ('B'), followed by the frame count and every frame prefixed by its length
+#define WS_BATCH_KIND 0x42
+
+// Longest wait for the server before backing off
+#define WS_CONNECT_TIMEOUT_MS 5000
+
+// Backoff after the first failed attempt, doubled every attempt up to WS_BACKOFF_MAX_MS
+#define WS_BACKOFF_BASE_MS 1000
+#define WS_BACKOFF_MAX_MS 60000
+
+// Alarms that can wait for an acknowledgement at the same time
+#define WS_ACK_WINDOW 8
+
+// Alarm is resent if the server doesn't acknowledge it in this time
+#define WS_ACK_TIMEOUT_MS 3000
+
+// Alarms go out as "rel=<sequence>;<message>", binary ones as 'R', sequence (4 bytes), frame
+#define WS_RELIABLE_PREFIX "rel="
+#define WS_RELIABLE_KIND 0x52
+
+// Server acknowledges an alarm with "wsack=<sequence>"
+#define WS_ACK_PREFIX "wsack="
+#define WS_ACK_PREFIX_LENGTH 6
+
+// Send time histogram, bucket N counts sends that took 2^N to 2^(N+1) µs, the last one anything slower
+#define WS_LATENCY_BUCKETS 16
+
+static_assert(TELEMETRY_FRAME_MAX_SIZE <= WS_PAYLOAD_CAPACITY, "Telemetry frames must fit in a queue slot");
+static_assert(WS_PAYLOAD_CAPACITY + 16 <= 255, "Messages and their sequence must fit a one byte length");
+
+
+/**
+ * @brief How much a message matters when the queue is full
+ */
+enum WebSocketPriority : uint8_t
+{
+  WS_PRIORITY_NORMAL = 0, // Readings, the oldest ones are dropped first
+  WS_PRIORITY_ALARM = 1,  // Leak alarms, resent until acknowledged. Readings never take their place, when the queue
+                          // is all alarms a new reading is dropped and only a new alarm drops the oldest alarm
+};
+
+
+/**
+ * @brief State of the connection to the server
+ */
+enum WebSocketState : uint8_t
+{
+  WS_STATE_IDLE = 0,    // init() wasn't called
+  WS_STATE_WIFI_WAIT,   // Waiting for the WiFi
+  WS_STATE_CONNECTING,  // Waiting for the server to accept, up to WS_CONNECT_TIMEOUT_MS
+  WS_STATE_CONNECTED,
+  WS_STATE_BACKOFF,     // Waiting before the next attempt
+};
+
+/**
+ * @brief Cost of the messages sent so far, and of getting the connection back
+ */
+struct WebSocketStats
+{
+  uint32_t messages;    // Messages sent
+  uint32_t overflows;   // Messages refused because they didn't fit in WS_PAYLOAD_CAPACITY
+  uint32_t dropped;     // Messages dropped because the queue was full, queued ones or the new reading
+  uint32_t acknowledged;  // Alarms acknowledged by the server
+  uint32_t retransmits;   // Alarms sent again because no acknowledgement came in time
+  uint32_t last_us;     // Time from the first put() to the end of launch() of the last message
+  uint32_t max_us;      // Slowest message
+  uint64_t total_us;    // Every message together, divide by messages for the average
+  uint64_t bytes;       // Payload handed to the library, frame headers not included
+  uint32_t latency_histogram[WS_LATENCY_BUCKETS];
+  uint32_t attempts;            // Connection attempts
+  uint32_t reconnects;          // Successful connections
+  uint32_t last_reconnect_ms;   // Time from losing the connection (or init) to getting it back
+  uint32_t max_reconnect_ms;    // Longest outage
+
+  /**
+   * @brief Get the upper bound of the histogram bucket that percent of the messages fall in
+   * @note Not the percentile itself, only the power of two above it. test/host/websocket_benchmark.cpp measures exact ones
+   * @return bucket bound in µs, UINT32_MAX if it's the last bucket
+   * 
+   * @code
+   * const WebSocketStats &stats = ws_manager.get_stats();
+   * Serial.printf("half under %u us, 99%% under %u us\n", stats.get_latency_bound(50), stats.get_latency_bound(99));
+   * @endcode
+   */
+  uint32_t get_latency_bound(uint8_t percent) const;
+};
 
 class WebSocketManager
 {
@@ -14,7 +113,73 @@ private:
 const char *address;
 uint16_t port;
 WebSocketsClient web_socket;
-String payload;
+uint32_t frame_sequence = 0;
+
+WebSocketState state = WS_STATE_IDLE;
+uint32_t state_start_time = 0;
+uint32_t outage_start_time = 0;
+uint32_t backoff_delay = 0;
+uint8_t attempt = 0;
+
+void start_connecting(uint32_t current_time);
+void start_backoff(uint32_t current_time);
+
+// Text message being built
+char payload[WS_PAYLOAD_CAPACITY];
+size_t payload_length = 0;
+bool payload_overflow = false;
+uint32_t payload_start_time = 0;
+
+WebSocketStats stats = {};
+
+// Messages waiting for the connection, oldest first
+struct QueuedMessage
+{
+  uint8_t priority;
+  bool binary;
+  uint8_t length;
+  uint8_t data[WS_PAYLOAD_CAPACITY];
+};
+
+QueuedMessage queue[WS_QUEUE_SIZE];
+uint8_t queue_length = 0;
+uint8_t normal_count = 0;
+
+// Outgoing frame, the space in front is for the frame header so the library sends it in place
+uint8_t batch[WEBSOCKETS_MAX_HEADER_SIZE + WS_BATCH_CAPACITY];
+
+// Alarms sent but not acknowledged yet
+struct InFlightMessage
+{
+  bool used;
+  bool sent;
+  bool binary;
+  uint8_t length;
+  uint32_t sequence;
+  uint32_t sent_time;
+  uint8_t data[WS_PAYLOAD_CAPACITY + 16]; // Message with its sequence in front
+};
+
+InFlightMessage in_flight[WS_ACK_WINDOW] = {};
+uint32_t delivery_sequence = 0;
+
+bool append(const char *data, size_t length);
+bool append_integer(uint64_t magnitude, bool negative);
+bool append_float(float data);
+void reset_payload();
+void record_send(uint32_t start_time, size_t length);
+
+bool send(bool binary, const uint8_t *data, size_t length, uint8_t priority, uint32_t start_time);
+bool transmit(bool binary, const uint8_t *data, size_t length);
+bool transmit_batch(bool binary, size_t length);
+void enqueue(bool binary, const uint8_t *data, size_t length, uint8_t priority);
+void drop_oldest(bool normal_only);
+void remove_queued(uint8_t index, uint8_t count);
+void flush_queue();
+
+bool add_in_flight(bool binary, const uint8_t *data, size_t length);
+void retransmit(uint32_t current_time);
+void acknowledge(uint32_t sequence);
 
 public:
 
@@ -23,7 +188,7 @@ public:
 /**
  * @brief Used to connect to {address} in {port} port.
  * @note This function should be called before sending or listening to any data 
- * @note This function can also be called with WiFi connection first
+ * @note WiFi doesn't have to be up yet, loop() connects once it is and reconnects with backoff
  * 
  * @code
  * init("ws.example.com", 80);
@@ -36,6 +201,7 @@ bool init(const char *ssid, const char *pass, const char *address, uint16_t port
 
 /**
  * @brief Used to listen to changes or updates that web socket server sends
+ * @note Can be called before connecting, the listener is kept across reconnections
  * 
  * @param callback this function will be called whenever there's data from web socket server
  * 
@@ -55,8 +221,13 @@ void listen(void (*callback)(WStype_t type, uint8_t * payload, size_t length));
 
 /**
  * @brief Used to prepare data through web socket connection 
+ * @note Nothing is allocated, the message is built in a fixed buffer of WS_PAYLOAD_CAPACITY bytes
+ * @note test/host/websocket_benchmark.cpp, 2 sensor snapshot of 68 bytes: appending String(data) to a String took
+ *       1 allocation and 1.4 µs p50, 2.4 µs p99 per message, this takes 0 and 1.3 µs p50, 1.9 µs p99.
+ *       The host string keeps 15 characters inline, the ESP32 String fewer, so there the old way allocated more
  * 
- * @param data all sorts of things that can be convereted into a string
+ * @param data int, uint8_t, int8_t, uint32_t, uint64_t, float (2 decimals), char or String
+ * @return false if the message doesn't fit, launch() then refuses to send it
  * 
  * 
  * @code
@@ -69,10 +240,16 @@ void listen(void (*callback)(WStype_t type, uint8_t * payload, size_t length));
  */
 template <typename T>
 bool put(const T& data);
+bool put(const char *data);
 
 
 /**
  * @brief Used to launch the message to the sky!!.. Oh, I mean web socket server!
+ * @note When disconnected the message is queued and sent on reconnect, coalesced with the others
+ * 
+ * @param priority WS_PRIORITY_ALARM for messages that must reach the server, they're numbered and resent
+ *        until the server replies "wsack=<sequence>", up to WS_ACK_WINDOW at the same time
+ * @return false if the message was too long, true once it's sent or queued
  * 
  * @code
  * uint8_t sensor_1 = 10;
@@ -81,34 +258,74 @@ bool put(const T& data);
  * ws_manager.launch();
  * @endcode
  */
-bool launch();
+bool launch(uint8_t priority = WS_PRIORITY_NORMAL);
 
+/**
+ * @brief Used to launch binary data right away, without going through put()
+ * @note It's not queued, false when disconnected
+ * 
+ * @code
+ * uint8_t frame[16];
+ * ws_manager.launch(frame, sizeof(frame));
+ * @endcode
+ */
+bool launch(const uint8_t *data, size_t length);
 
 /**
- * @brief Used to automatically reconnect to the web socket server when disconnected
- * @note can be called in a loop()
+ * @brief Used to launch a binary telemetry frame, its sequence number is filled in here
+ * @note Queued like launch() when disconnected
  * 
  * @code
- * void loop() {
- *   auto_reconnect(); // This will block program when disconnected to the web socket server
- * }
+ * TelemetryFrame frame = {};
+ * frame.kind = TELEMETRY_FRAME_FLOW;
+ * frame.value_count = 1;
+ * frame.values[0] = 6170;
+ * ws_manager.launch(frame);
  * @endcode
  */
-void wait_to_connect();
+bool launch(TelemetryFrame &frame, uint8_t priority = WS_PRIORITY_NORMAL);
+
+/**
+ * @brief Check if the web socket is connected to the server
+ */
+bool is_connected();
+
+/**
+ * @brief Get the cost of the messages sent so far
+ */
+const WebSocketStats &get_stats();
+
 
 /**
  * @brief Used to make web socket client works.
- * @note Should be called in a loop()
+ * @note Should be called in a loop(), also while the WiFi is down
+ * @note Connects, reconnects with exponential backoff and jitter, and sends the messages queued while disconnected
+ * @note Never waits for the server, only the connection attempt itself takes as long as the library needs
  * 
  * 
  * @code
  * void loop() {
- *   loop(); // This will block program when disconnected to the web socket server
+ *   ws_manager.loop(); // Keeps going when disconnected from the web socket server
  * }
  * @endcode
  * 
  */
 void loop();
 
+/**
+ * @brief Used to get the state of the connection to the server
+ */
+WebSocketState get_state();
+
 static void handle_data(WStype_t type, uint8_t * payload, size_t length);
 };
+
+// Formatters of every type put() accepts, anything else fails to link
+template <> bool WebSocketManager::put<int>(const int& data);
+template <> bool WebSocketManager::put<uint8_t>(const uint8_t& data);
+template <> bool WebSocketManager::put<int8_t>(const int8_t& data);
+template <> bool WebSocketManager::put<uint32_t>(const uint32_t& data);
+template <> bool WebSocketManager::put<uint64_t>(const uint64_t& data);
+template <> bool WebSocketManager::put<float>(const float& data);
+template <> bool WebSocketManager::put<char>(const char& data);
+template <> bool WebSocketManager::put<String>(const String& data);
@@ -0,0 +1,118 @@
+/**
+ * @brief FlowSensor driven through SimulatedPulseCounter, checks flow rate and totals
+ * @note Built and run by test/host/run.sh
+ */
+#include <FlowSensor.h>
+#include <SimulatedPulseCounter.h>
+
+static int failures = 0;
+
+#define CHECK_EQUAL(actual, expected) check_equal(__LINE__, #actual, (uint64_t) (actual), (uint64_t) (expected))
+
+static void check_equal(int line, const char *name, uint64_t actual, uint64_t expected) {
+  if(actual == expected) return;
+
+  printf("flow_sensor_test.cpp:%d: %s is %llu, expected %llu\n", line, name, (unsigned long long) actual, (unsigned long long) expected);
+  failures++;
+}
+
+// One counting window of update(), pulses spread over a second
+static void run_window(FlowSensor &sensor, SimulatedPulseCounter &counter, uint32_t pulses) {
+  counter.inject(pulses);
+  host_advance_us(1000000);
+  sensor.update();
+}
+
+
+//? Pulse count windows
+static void test_counted_flow() {
+  host_freeze_clock();
+  SimulatedPulseCounter counter;
+  FlowSensor sensor(0, 0, FLOW_SENSOR_DEFAULT_CALIBRATION_FACTOR, &counter);
+
+  // 7.5 Hz per L/min, 75 pulses in a second is 10 L/min
+  run_window(sensor, counter, 75);
+  CHECK_EQUAL(sensor.get_flow_rate_mlpm(), 10000);
+  CHECK_EQUAL(sensor.get_total_pulses(), 75);
+  CHECK_EQUAL(sensor.get_total_millilitres(), 166);
+
+  // A minute at 10 L/min is 10 litres, from the pulse total with no rounding per window
+  for(uint8_t second = 1; second < 60; second++) run_window(sensor, counter, 75);
+  CHECK_EQUAL(sensor.get_total_pulses(), 4500);
+  CHECK_EQUAL(sensor.get_total_millilitres(), 10000);
+
+  // Nothing counted, nothing flowing
+  run_window(sensor, counter, 0);
+  CHECK_EQUAL(sensor.get_flow_rate_mlpm(), 0);
+  CHECK_EQUAL(sensor.get_total_millilitres(), 10000);
+}
+
+//? Pulse period at low flow
+static void test_period_flow() {
+  host_freeze_clock();
+  SimulatedPulseCounter counter;
+  FlowSensor sensor(0, 0, FLOW_SENSOR_DEFAULT_CALIBRATION_FACTOR, &counter);
+
+  // 2 Hz is too slow to count in a second, the period gives 266 mL/min
+  host_advance_us(1000000);
+  counter.inject(2, 500000);
+  sensor.update();
+  CHECK_EQUAL(sensor.get_flow_rate_mlpm(), 266);
+
+  // No pulse for longer than FLOW_SENSOR_PERIOD_TIMEOUT_US, the water stopped
+  host_advance_us(FLOW_SENSOR_PERIOD_TIMEOUT_US + 1000);
+  sensor.update();
+  CHECK_EQUAL(sensor.get_flow_rate_mlpm(), 0);
+}
+
+//? Restored totals
+static void test_restored_totals() {
+  host_freeze_clock();
+  SimulatedPulseCounter counter;
+  FlowSensor sensor(0, 0, FLOW_SENSOR_DEFAULT_CALIBRATION_FACTOR, &counter);
+
+  sensor.restore_totals(450000, 1000000);
+  run_window(sensor, counter, 450);
+  CHECK_EQUAL(sensor.get_total_pulses(), 450450);
+  CHECK_EQUAL(sensor.get_total_millilitres(), 1001000);
+}
+
+//? Calibration curves
+static void test_calibrated_volume() {
+  host_freeze_clock();
+  SimulatedPulseCounter counter;
+  FlowSensor sensor(0, 0, FLOW_SENSOR_DEFAULT_CALIBRATION_FACTOR, &counter);
+
+  // The default curve is a straight line, volume stays exact from the pulse total
+  sensor.set_calibration(YF_S201_CALIBRATION);
+  for(uint8_t second = 0; second < 60; second++) run_window(sensor, counter, 74);
+  CHECK_EQUAL(sensor.get_flow_rate_mlpm(), 9866);
+  CHECK_EQUAL(sensor.get_total_millilitres(), 9866);
+
+  // Bent curve, 5 Hz is 600 mL/min and 10 Hz is 1500 mL/min
+  CalibrationCurve bent = {{{0, 0}, {5000, 600}, {10000, 1500}}, 3};
+  sensor.set_calibration(bent);
+
+  // 7 Hz is 960 mL/min, 16 mL a second with no rounding lost per window
+  for(uint8_t second = 0; second < 60; second++) run_window(sensor, counter, 7);
+  CHECK_EQUAL(sensor.get_flow_rate_mlpm(), 960);
+  CHECK_EQUAL(sensor.get_total_millilitres(), 9866 + 960);
+
+  // 1 Hz is 333.3 mL/min, truncating it to 333 would lose 3 mL in ten minutes
+  CalibrationCurve fractional = {{{0, 0}, {3000, 1000}, {6000, 3000}}, 3};
+  sensor.set_calibration(fractional);
+  for(uint16_t second = 0; second < 600; second++) run_window(sensor, counter, 1);
+  CHECK_EQUAL(sensor.get_flow_rate_mlpm(), 333);
+  CHECK_EQUAL(sensor.get_total_millilitres(), 9866 + 960 + 3333);
+}
+
+
+int main() {
+  test_counted_flow();
+  test_period_flow();
+  test_restored_totals();
+  test_calibrated_volume();
+
+  printf("flow_sensor_test: %s\n", failures == 0 ? "passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
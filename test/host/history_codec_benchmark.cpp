@@ -0,0 +1,110 @@
+/**
+ * @brief HistoryCodec size and speed on telemetry log pages, the source of the figures in HistoryCodec.h
+ * @details A page is PAGE_SAMPLES records of 2 sensors taken once a second: timestamp, leaking segments
+ *          and the pulses of each sensor, 19 bytes per record in the raw log. Every page is decoded back
+ *          and compared. The random series are seeded, so the sizes are the same on every run.
+ * @note Built and run by test/host/run.sh
+ */
+#include <HistoryCodec.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+
+#define PAGE_SAMPLES 200
+#define SENSOR_COUNT 2
+#define CHANNEL_COUNT (1 + SENSOR_COUNT)
+#define RAW_RECORD_SIZE 19
+#define REPEATS 2000
+
+static int failures = 0;
+
+struct Scenario
+{
+  const char *name;
+  bool run_length;
+  int jitter;         // Pulses are base ± jitter, or 0..999 when negative
+  uint32_t base;
+};
+
+static void fill_page(const Scenario &scenario, uint32_t timestamps[PAGE_SAMPLES], uint32_t values[PAGE_SAMPLES][CHANNEL_COUNT]) {
+  std::mt19937 generator(1);
+
+  for(uint32_t sample = 0; sample < PAGE_SAMPLES; sample++) {
+    timestamps[sample] = 1760000000 + sample;
+    values[sample][0] = 0;
+
+    for(uint8_t sensor = 0; sensor < SENSOR_COUNT; sensor++) {
+      uint32_t pulses = scenario.base;
+      if(scenario.jitter < 0) pulses = generator() % 1000;
+      else if(scenario.jitter > 0) pulses = scenario.base - scenario.jitter + generator() % (2 * scenario.jitter + 1);
+      values[sample][1 + sensor] = pulses;
+    }
+  }
+}
+
+static size_t encode_page(const Scenario &scenario, const uint32_t timestamps[PAGE_SAMPLES], const uint32_t values[PAGE_SAMPLES][CHANNEL_COUNT], uint8_t *buffer, size_t capacity) {
+  HistoryEncoder encoder;
+  encoder.begin(buffer, capacity, CHANNEL_COUNT, scenario.run_length);
+
+  for(uint32_t sample = 0; sample < PAGE_SAMPLES; sample++) {
+    if(!encoder.add(timestamps[sample], values[sample])) return 0;
+  }
+
+  return encoder.finish();
+}
+
+static bool decode_page(const uint8_t *buffer, size_t length, const uint32_t timestamps[PAGE_SAMPLES], const uint32_t values[PAGE_SAMPLES][CHANNEL_COUNT]) {
+  HistoryDecoder decoder;
+  if(!decoder.begin(buffer, length) || decoder.get_channel_count() != CHANNEL_COUNT) return false;
+
+  uint32_t timestamp;
+  uint32_t decoded[CHANNEL_COUNT];
+  for(uint32_t sample = 0; sample < PAGE_SAMPLES; sample++) {
+    if(!decoder.next(timestamp, decoded)) return false;
+    if(timestamp != timestamps[sample] || memcmp(decoded, values[sample], sizeof(decoded)) != 0) return false;
+  }
+
+  return !decoder.next(timestamp, decoded) && !decoder.has_error();
+}
+
+static void run(const Scenario &scenario) {
+  static uint32_t timestamps[PAGE_SAMPLES];
+  static uint32_t values[PAGE_SAMPLES][CHANNEL_COUNT];
+  static uint8_t buffer[PAGE_SAMPLES * RAW_RECORD_SIZE];
+  fill_page(scenario, timestamps, values);
+
+  size_t length = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t repeat = 0; repeat < REPEATS; repeat++) {
+    length = encode_page(scenario, timestamps, values, buffer, sizeof(buffer));
+  }
+  double encode_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / REPEATS / PAGE_SAMPLES;
+
+  if(length == 0 || !decode_page(buffer, length, timestamps, values)) {
+    printf("history_codec_benchmark: %s doesn't round trip\n", scenario.name);
+    failures++;
+    return;
+  }
+
+  size_t raw = PAGE_SAMPLES * RAW_RECORD_SIZE;
+  printf("%-28s %5u bytes  %5.2f bytes/sample  %6.1f:1  %5.1f ns/sample\n",
+         scenario.name, (unsigned) length, (double) length / PAGE_SAMPLES, (double) raw / length, encode_ns);
+}
+
+
+int main() {
+  const Scenario scenarios[] = {
+    { "idle",                    true,   0,  0 },
+    { "idle, no run-length",     false,  0,  0 },
+    { "steady flow, +-2 pulses", true,   2, 75 },
+    { "random pulses 0..999",    true,  -1,  0 },
+  };
+
+  printf("history_codec_benchmark: %u samples per page, %u sensors, raw page %u bytes\n",
+         PAGE_SAMPLES, SENSOR_COUNT, PAGE_SAMPLES * RAW_RECORD_SIZE);
+  for(const Scenario &scenario : scenarios) run(scenario);
+
+  printf("history_codec_benchmark: %s\n", failures == 0 ? "passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+/**
+ * @brief LeakDetector rolling window, threshold search and detection on seeded Gaussian noise
+ * @details Noise is the upstream/downstream difference of a segment without a leak. Detection delay and
+ *          false alarms are counted over seeded series, so every run gives the same numbers.
+ * @note Built and run by test/host/run.sh
+ */
+#include <LeakDetector.h>
+#include <random>
+
+#define NOISE_MLPM 150
+#define LEAK_MLPM 300
+#define DELAY_TRIALS 1000
+#define FALSE_ALARM_SAMPLES 200000
+#define RUN_LENGTH_TARGET 2000
+#define RUN_LENGTH_ALARMS 200
+
+static int failures = 0;
+
+#define CHECK(condition) check(__LINE__, #condition, condition)
+
+static void check(int line, const char *name, bool condition) {
+  if(condition) return;
+
+  printf("leak_detector_test.cpp:%d: %s failed\n", line, name);
+  failures++;
+}
+
+// Difference of one sample, noise plus the leak
+static int32_t draw(std::mt19937 &generator, std::normal_distribution<double> &noise, int32_t leak_mlpm) {
+  return leak_mlpm + (int32_t) lround(noise(generator));
+}
+
+// Samples until the first alarm, or limit if it never came
+static uint32_t run_until_alarm(LeakDetector &detector, std::mt19937 &generator, int32_t leak_mlpm, uint32_t limit) {
+  std::normal_distribution<double> noise(0, NOISE_MLPM);
+  for(uint32_t sample = 1; sample <= limit; sample++) {
+    detector.add_sample(draw(generator, noise, leak_mlpm), 0);
+    if(detector.is_leaked()) return sample;
+  }
+  return limit;
+}
+
+
+//? Rolling window
+static void test_window() {
+  LeakDetector detector;
+
+  // Fewer than two samples have no spread
+  detector.add_sample(500, 100);
+  CHECK(detector.get_leak_rate_mlpm() == 400);
+  CHECK(detector.get_noise_mlpm() == 0);
+
+  // Past the window only the last LEAK_DETECTOR_WINDOW samples count
+  detector.reset();
+  int32_t differences[LEAK_DETECTOR_WINDOW + 10];
+  for(uint8_t index = 0; index < LEAK_DETECTOR_WINDOW + 10; index++) {
+    differences[index] = index < 10 ? 100000 : (index % 2 ? 50 : 150);
+    detector.add_sample(differences[index], 0);
+  }
+
+  double mean = 0;
+  for(uint8_t index = 10; index < LEAK_DETECTOR_WINDOW + 10; index++) mean += differences[index];
+  mean /= LEAK_DETECTOR_WINDOW;
+  double variance = 0;
+  for(uint8_t index = 10; index < LEAK_DETECTOR_WINDOW + 10; index++) variance += (differences[index] - mean) * (differences[index] - mean);
+  variance /= LEAK_DETECTOR_WINDOW - 1;
+
+  CHECK(detector.get_leak_rate_mlpm() == 100);
+  CHECK(fabs(detector.get_noise_mlpm() - sqrt(variance)) < 0.01);
+
+  // More water out than in isn't a leak rate
+  detector.reset();
+  detector.add_sample(0, 300);
+  CHECK(detector.get_leak_rate_mlpm() == 0);
+}
+
+//? Threshold and probability
+static void test_probability() {
+  LeakDetector detector;
+  detector.configure(86400, NOISE_MLPM);
+
+  // Balanced flow gives no evidence
+  for(uint8_t sample = 0; sample < 100; sample++) detector.add_sample(1000, 1000);
+  CHECK(detector.get_leak_probability() == 0);
+  CHECK(!detector.is_leaked());
+
+  // Evidence builds up, reaches 1 at the alarm and stays capped there
+  float previous = 0;
+  bool rising = true;
+  while(!detector.is_leaked()) {
+    detector.add_sample(1000 + 2 * NOISE_MLPM, 1000);
+    rising = rising && detector.get_leak_probability() > previous;
+    previous = detector.get_leak_probability();
+  }
+  CHECK(rising);
+  CHECK(detector.get_leak_probability() == 1);
+
+  // A rarer false alarm needs more evidence, so it takes longer to reach
+  LeakDetector strict;
+  LeakDetector loose;
+  strict.configure(86400 * 7, NOISE_MLPM);
+  loose.configure(3600, NOISE_MLPM);
+  uint32_t strict_samples = 0;
+  uint32_t loose_samples = 0;
+  while(!strict.is_leaked()) { strict.add_sample(2 * NOISE_MLPM, 0); strict_samples++; }
+  while(!loose.is_leaked()) { loose.add_sample(2 * NOISE_MLPM, 0); loose_samples++; }
+  CHECK(strict_samples > loose_samples);
+}
+
+//? Detection delay of a leak step
+static void test_detection_delay() {
+  std::mt19937 generator(1);
+  uint64_t total = 0;
+  uint32_t slowest = 0;
+  uint32_t trials = 0;
+
+  for(uint32_t trial = 0; trial < DELAY_TRIALS; trial++) {
+    LeakDetector detector;
+    detector.configure(LEAK_DETECTOR_DEFAULT_FALSE_ALARM_SAMPLES, NOISE_MLPM);
+
+    // Settle on a healthy pipe first, the step then lands in a full window
+    run_until_alarm(detector, generator, 0, 2 * LEAK_DETECTOR_WINDOW);
+    if(detector.is_leaked()) continue;
+
+    uint32_t delay = run_until_alarm(detector, generator, LEAK_MLPM, 1000);
+    total += delay;
+    trials++;
+    if(delay > slowest) slowest = delay;
+  }
+
+  double average = (double) total / trials;
+  printf("leak_detector_test: %d mL/min leak in %d mL/min noise, detected after %.1f samples on average, %u at most\n",
+         LEAK_MLPM, NOISE_MLPM, average, slowest);
+  CHECK(average < 16);
+  CHECK(slowest < 60);
+}
+
+//? False alarms against the configured run length
+static void test_false_alarms() {
+  std::mt19937 generator(2);
+  std::normal_distribution<double> noise(0, NOISE_MLPM);
+  LeakDetector detector;
+  detector.configure(LEAK_DETECTOR_DEFAULT_FALSE_ALARM_SAMPLES, NOISE_MLPM);
+
+  // Count alarms as they start, the detector clears by itself once the evidence decays
+  uint32_t alarms = 0;
+  bool leaked = false;
+  for(uint32_t sample = 0; sample < FALSE_ALARM_SAMPLES; sample++) {
+    detector.add_sample(draw(generator, noise, 0), 0);
+    if(detector.is_leaked() && !leaked) alarms++;
+    leaked = detector.is_leaked();
+  }
+
+  double expected = (double) FALSE_ALARM_SAMPLES / LEAK_DETECTOR_DEFAULT_FALSE_ALARM_SAMPLES;
+  printf("leak_detector_test: %u false alarms in %u samples without a leak, %.1f expected\n", alarms, FALSE_ALARM_SAMPLES, expected);
+  CHECK(alarms <= 4 * expected);
+
+  // Average run length to a false alarm, on a short target so enough alarms happen
+  uint64_t total = 0;
+  for(uint32_t alarm = 0; alarm < RUN_LENGTH_ALARMS; alarm++) {
+    detector.configure(RUN_LENGTH_TARGET, NOISE_MLPM);
+    total += run_until_alarm(detector, generator, 0, 100 * RUN_LENGTH_TARGET);
+  }
+
+  double run_length = (double) total / RUN_LENGTH_ALARMS;
+  printf("leak_detector_test: configured for %u samples between false alarms, got %.0f\n", RUN_LENGTH_TARGET, run_length);
+  CHECK(run_length > RUN_LENGTH_TARGET / 2);
+  CHECK(run_length < RUN_LENGTH_TARGET * 4);
+}
+
+
+int main() {
+  test_window();
+  test_probability();
+  test_detection_delay();
+  test_false_alarms();
+
+  printf("leak_detector_test: %s\n", failures == 0 ? "passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""Loopback WebSocket server for test/host/websocket_benchmark.cpp, standard library only.
+
+Refuses the handshake (401) unless the Cookie header matches --cookie, the ENV_COOKIE of the host build.
+Counts every message and its payload bytes, answers alarms ("rel=<sequence>;..." or binary 'R' frames)
+with "wsack=<sequence>", and answers "bench-end" with "bench-received=<messages>,<bytes>" for the messages
+since the previous bench-end.
+
+    test/host/loopback_server.py --cookie access_token=host-bench --port-file build/ws_port
+"""
+import argparse
+import base64
+import hashlib
+import socket
+import socketserver
+import struct
+
+GUID = b"258EAFA5-E914-47DA-95CA-C5AB0DC11B5A"
+
+
+def read_exact(stream, length):
+    data = stream.read(length)
+    if len(data) != length:
+        raise ConnectionError("connection closed")
+    return data
+
+
+def send_frame(connection, opcode, payload):
+    header = bytes([0x80 | opcode])
+    if len(payload) < 126:
+        header += bytes([len(payload)])
+    elif len(payload) <= 0xFFFF:
+        header += bytes([126]) + struct.pack(">H", len(payload))
+    else:
+        header += bytes([127]) + struct.pack(">Q", len(payload))
+    connection.sendall(header + payload)
+
+
+class Handler(socketserver.StreamRequestHandler):
+    def handle(self):
+        headers = {}
+        request_line = self.rfile.readline()
+        while True:
+            line = self.rfile.readline()
+            if line in (b"\r\n", b"\n", b""):
+                break
+            name, _, value = line.decode("latin-1").partition(":")
+            headers[name.strip().lower()] = value.strip()
+
+        if not request_line.startswith(b"GET ") or "sec-websocket-key" not in headers:
+            self.wfile.write(b"HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n")
+            return
+
+        if headers.get("cookie") != self.server.cookie:
+            self.wfile.write(b"HTTP/1.1 401 Unauthorized\r\nContent-Length: 0\r\n\r\n")
+            return
+
+        accept = base64.b64encode(hashlib.sha1(headers["sec-websocket-key"].encode() + GUID).digest())
+        response = b"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        response += b"Sec-WebSocket-Accept: " + accept + b"\r\n"
+        if "sec-websocket-protocol" in headers:
+            response += b"Sec-WebSocket-Protocol: " + headers["sec-websocket-protocol"].encode() + b"\r\n"
+        self.wfile.write(response + b"\r\n")
+
+        messages = 0
+        payload_bytes = 0
+        try:
+            while True:
+                first, second = read_exact(self.rfile, 2)
+                opcode = first & 0x0F
+                length = second & 0x7F
+                if length == 126:
+                    length = struct.unpack(">H", read_exact(self.rfile, 2))[0]
+                elif length == 127:
+                    length = struct.unpack(">Q", read_exact(self.rfile, 8))[0]
+
+                # Clients must mask, anything else is a broken client
+                if not second & 0x80:
+                    raise ConnectionError("unmasked client frame")
+                mask = read_exact(self.rfile, 4)
+                payload = bytes(byte ^ mask[index & 3] for index, byte in enumerate(read_exact(self.rfile, length)))
+
+                if opcode == 0x8:
+                    send_frame(self.connection, 0x8, b"")
+                    return
+                if opcode == 0x9:
+                    send_frame(self.connection, 0xA, payload)
+                    continue
+                if opcode not in (0x1, 0x2):
+                    continue
+
+                if opcode == 0x1 and payload == b"bench-end":
+                    send_frame(self.connection, 0x1, b"bench-received=%d,%d" % (messages, payload_bytes))
+                    messages = 0
+                    payload_bytes = 0
+                    continue
+
+                messages += 1
+                payload_bytes += length
+
+                if opcode == 0x1 and payload.startswith(b"rel="):
+                    send_frame(self.connection, 0x1, b"wsack=" + payload[4:].split(b";", 1)[0])
+                elif opcode == 0x2 and length >= 5 and payload[0] == 0x52:
+                    send_frame(self.connection, 0x1, b"wsack=%d" % struct.unpack("<I", payload[1:5])[0])
+        except (ConnectionError, OSError):
+            pass
+
+
+class Server(socketserver.ThreadingTCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--cookie", required=True, help="expected Cookie header value")
+    parser.add_argument("--port", type=int, default=0, help="0 picks a free port")
+    parser.add_argument("--port-file", help="write the port here once listening")
+    arguments = parser.parse_args()
+
+    with Server(("127.0.0.1", arguments.port), Handler) as server:
+        server.cookie = arguments.cookie
+        if arguments.port_file:
+            with open(arguments.port_file, "w") as port_file:
+                port_file.write("%d\n" % server.server_address[1])
+        server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
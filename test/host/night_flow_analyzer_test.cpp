@@ -0,0 +1,162 @@
+/**
+ * @brief NightFlowAnalyzer driven one sample per second over synthetic nights
+ * @details Time is UTC, so the quiet window is at the same epoch offsets every night.
+ * @note Built and run by test/host/run.sh
+ */
+#include <NightFlowAnalyzer.h>
+#include <stdlib.h>
+
+// Wednesday 1 January 2025, 00:00 UTC
+#define FIRST_MIDNIGHT 1735689600
+#define DAY_SECONDS 86400
+#define HOUR_SECONDS 3600
+
+// A flush or a tap every 10 minutes, 4 L/min for 20 seconds
+#define BURST_PERIOD_S 600
+#define BURST_LENGTH_S 20
+#define BURST_MLPM 4000
+
+static int failures = 0;
+
+#define CHECK_EQUAL(actual, expected) check_equal(__LINE__, #actual, (int64_t) (actual), (int64_t) (expected))
+
+static void check_equal(int line, const char *name, int64_t actual, int64_t expected) {
+  if(actual == expected) return;
+
+  printf("night_flow_analyzer_test.cpp:%d: %s is %lld, expected %lld\n", line, name, (long long) actual, (long long) expected);
+  failures++;
+}
+
+// One sample per second from from_s to to_s after midnight, the base flow with bursts on top
+static void run_span(NightFlowAnalyzer &analyzer, time_t midnight, uint32_t from_s, uint32_t to_s, uint32_t base_mlpm, bool bursts) {
+  for(uint32_t second = from_s; second < to_s; second++) {
+    uint32_t flow = base_mlpm;
+    if(bursts && second % BURST_PERIOD_S < BURST_LENGTH_S) flow += BURST_MLPM;
+    analyzer.sample(flow, midnight + second);
+  }
+}
+
+static uint8_t count_nights(const NightFlowAnalyzer &analyzer) {
+  uint32_t nights[NIGHT_FLOW_HISTORY_DAYS];
+  return analyzer.get_history(nights, NIGHT_FLOW_HISTORY_DAYS);
+}
+
+// 01:00 to 05:00 covers the default 02:00 to 04:00 window and closes it
+static void run_night(NightFlowAnalyzer &analyzer, uint8_t night, uint32_t base_mlpm, bool bursts) {
+  run_span(analyzer, FIRST_MIDNIGHT + (time_t) night * DAY_SECONDS, 1 * HOUR_SECONDS, 5 * HOUR_SECONDS, base_mlpm, bursts);
+}
+
+
+//? Rising minimum
+static void test_rising_trend() {
+  NightFlowAnalyzer analyzer;
+
+  // 10 mL/min more every night, with bursts that never let a minute go quiet
+  for(uint8_t night = 0; night < 8; night++) {
+    run_night(analyzer, night, night * 10, true);
+
+    // Too few nights to tell before NIGHT_FLOW_MIN_NIGHTS
+    CHECK_EQUAL(analyzer.has_background_leak(), night + 1 >= NIGHT_FLOW_MIN_NIGHTS);
+    CHECK_EQUAL(analyzer.get_last_night_minimum(), night * 10);
+  }
+
+  CHECK_EQUAL(lroundf(analyzer.get_trend()), 10);
+
+  uint32_t nights[NIGHT_FLOW_HISTORY_DAYS];
+  CHECK_EQUAL(analyzer.get_history(nights, NIGHT_FLOW_HISTORY_DAYS), 8);
+  CHECK_EQUAL(nights[0], 0);
+  CHECK_EQUAL(nights[7], 70);
+}
+
+//? Bursts on a tight installation
+static void test_bursts_ignored() {
+  NightFlowAnalyzer analyzer;
+
+  for(uint8_t night = 0; night < 8; night++) run_night(analyzer, night, 0, true);
+
+  CHECK_EQUAL(analyzer.get_last_night_minimum(), 0);
+  CHECK_EQUAL(lroundf(analyzer.get_trend()), 0);
+  CHECK_EQUAL(analyzer.has_background_leak(), false);
+}
+
+//? Water that never stops
+static void test_never_stopped() {
+  NightFlowAnalyzer steady_leak;
+  NightFlowAnalyzer below_threshold;
+
+  for(uint8_t night = 0; night < NIGHT_FLOW_MIN_NIGHTS; night++) {
+    run_night(steady_leak, night, NIGHT_FLOW_DEFAULT_BACKGROUND_MLPM + 10, false);
+    run_night(below_threshold, night, NIGHT_FLOW_DEFAULT_BACKGROUND_MLPM - 10, false);
+  }
+
+  // No trend at all, only the level tells them apart
+  CHECK_EQUAL(lroundf(steady_leak.get_trend()), 0);
+  CHECK_EQUAL(steady_leak.has_background_leak(), true);
+  CHECK_EQUAL(below_threshold.has_background_leak(), false);
+
+  // One quiet night clears it
+  run_night(steady_leak, NIGHT_FLOW_MIN_NIGHTS, 0, false);
+  CHECK_EQUAL(steady_leak.has_background_leak(), false);
+}
+
+//? Clock not set yet
+static void test_clock_not_set() {
+  NightFlowAnalyzer analyzer;
+
+  // Seconds since boot, a whole day of heavy flow that must not become a night
+  for(uint32_t second = 0; second < DAY_SECONDS; second++) analyzer.sample(10000, second);
+  CHECK_EQUAL(count_nights(analyzer), 0);
+  CHECK_EQUAL(analyzer.get_last_night_minimum(), 0);
+
+  // Once NTP sets the clock, nights count as usual
+  run_night(analyzer, 0, 25, false);
+  CHECK_EQUAL(analyzer.get_last_night_minimum(), 25);
+}
+
+//? Window crossing midnight
+static void test_window_across_midnight() {
+  NightFlowAnalyzer analyzer;
+  analyzer.configure(23 * 60, 1 * 60);
+
+  // 22:00 to 02:00, one night split by the date change
+  time_t midnight = FIRST_MIDNIGHT + DAY_SECONDS;
+  run_span(analyzer, midnight - 2 * HOUR_SECONDS, 0, 2 * HOUR_SECONDS, 100, false);
+  run_span(analyzer, midnight, 0, 1800, 60, false);                 // 00:00 to 00:30
+  run_span(analyzer, midnight, 1800, 2 * HOUR_SECONDS, 80, false);  // 00:30 to 02:00
+
+  uint32_t nights[NIGHT_FLOW_HISTORY_DAYS];
+  CHECK_EQUAL(analyzer.get_history(nights, NIGHT_FLOW_HISTORY_DAYS), 1);
+  CHECK_EQUAL(nights[0], 60);
+}
+
+//? Device started in the middle of the window
+static void test_partial_first_night() {
+  NightFlowAnalyzer started_at_half_past;
+  NightFlowAnalyzer started_at_the_end;
+
+  // From 03:30 there's still half an hour of full minutes
+  run_span(started_at_half_past, FIRST_MIDNIGHT, 3 * HOUR_SECONDS + 1800, 5 * HOUR_SECONDS, 45, false);
+  CHECK_EQUAL(count_nights(started_at_half_past), 1);
+  CHECK_EQUAL(started_at_half_past.get_last_night_minimum(), 45);
+
+  // From 03:59:30 no minute has enough samples, nothing is recorded
+  run_span(started_at_the_end, FIRST_MIDNIGHT, 4 * HOUR_SECONDS - 30, 5 * HOUR_SECONDS, 45, false);
+  CHECK_EQUAL(count_nights(started_at_the_end), 0);
+}
+
+
+int main() {
+  // Local time is UTC, nights are at fixed offsets from midnight
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  test_rising_trend();
+  test_bursts_ignored();
+  test_never_stopped();
+  test_clock_not_set();
+  test_window_across_midnight();
+  test_partial_first_night();
+
+  printf("night_flow_analyzer_test: %s\n", failures == 0 ? "passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Builds the libraries with the desktop compiler against test/host/stubs and runs the host checks.
+# No board or PlatformIO needed, only g++ (or $CXX) and python3 for the WebSocket loopback server.
+#
+#   test/host/run.sh
+set -e
+
+cd "$(dirname "$0")"
+ROOT=../..
+BUILD=build
+mkdir -p "$BUILD"
+
+INCLUDES="-Istubs $(for directory in "$ROOT"/lib/*/; do printf -- '-I%s ' "$directory"; done)"
+CXX="${CXX:-g++} -std=gnu++17 -O2 -Wall -Wextra -Wno-unused-parameter -Wno-switch"
+ARDUINO="stubs/HostArduino.cpp"
+
+build() {
+  name=$1
+  shift
+  $CXX $INCLUDES "$name.cpp" $ARDUINO "$@" -o "$BUILD/$name"
+}
+
+build flow_sensor_test "$ROOT/lib/flow_sensor/FlowSensor.cpp" "$ROOT/lib/flow_sensor/SimulatedPulseCounter.cpp" "$ROOT/lib/flow_sensor/CalibrationCurve.cpp"
+"$BUILD/flow_sensor_test"
+
+build leak_detector_test "$ROOT/lib/leak_detector/LeakDetector.cpp"
+"$BUILD/leak_detector_test"
+
+build night_flow_analyzer_test "$ROOT/lib/night_flow_analyzer/NightFlowAnalyzer.cpp"
+"$BUILD/night_flow_analyzer_test"
+
+build telemetry_frame_test "$ROOT/lib/telemetry_frame/TelemetryFrame.cpp"
+"$BUILD/telemetry_frame_test"
+
+build history_codec_benchmark "$ROOT/lib/history_codec/HistoryCodec.cpp"
+"$BUILD/history_codec_benchmark"
+
+# WebSocketManager against the loopback server, with the device cookie from stubs/env.h
+COOKIE=$(sed -n 's/.*ENV_COOKIE "Cookie: \(.*\)"/\1/p' stubs/env.h)
+build websocket_benchmark "$ROOT/lib/websocket_manager/WebSocketManager.cpp" "$ROOT/lib/telemetry_frame/TelemetryFrame.cpp" stubs/HostWebSocketsClient.cpp
+rm -f "$BUILD/ws_port"
+python3 loopback_server.py --cookie "$COOKIE" --port-file "$BUILD/ws_port" &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null' EXIT
+while [ ! -s "$BUILD/ws_port" ]; do
+  kill -0 $SERVER || exit 1
+  sleep 0.1
+done
+"$BUILD/websocket_benchmark" "$(cat "$BUILD/ws_port")"
@@ -0,0 +1,105 @@
+#pragma once
+
+// Just enough of the Arduino core to build the libraries on a desktop, see test/host/run.sh
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+#include <type_traits>
+
+#define IRAM_ATTR
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define INPUT_PULLDOWN 3
+#define RISING 1
+#define FALLING 2
+
+// Single threaded, nothing to lock
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) (void) (mux)
+#define portEXIT_CRITICAL(mux) (void) (mux)
+#define portENTER_CRITICAL_ISR(mux) (void) (mux)
+#define portEXIT_CRITICAL_ISR(mux) (void) (mux)
+
+//? Time
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+/**
+ * @brief Stop the clock, millis() and micros() then only move with host_advance_us()
+ * @note Tests use it to feed exact windows to time based code
+ */
+void host_freeze_clock(uint64_t start_us = 0);
+void host_advance_us(uint64_t us);
+
+//? GPIO, nothing is attached
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+uint32_t esp_random();
+
+// By value, a reference to the parameters would dangle
+template <typename T, typename U>
+typename std::common_type<T, U>::type min(T a, U b) { return a < b ? a : b; }
+
+template <typename T, typename U>
+typename std::common_type<T, U>::type max(T a, U b) { return a > b ? a : b; }
+
+//? String
+class String
+{
+public:
+  String() = default;
+  String(const char *value) : value(value ? value : "") {}
+  String(const std::string &value) : value(value) {}
+  explicit String(int value) : value(std::to_string(value)) {}
+  explicit String(unsigned int value) : value(std::to_string(value)) {}
+  explicit String(long value) : value(std::to_string(value)) {}
+  explicit String(unsigned long value) : value(std::to_string(value)) {}
+  explicit String(long long value) : value(std::to_string(value)) {}
+  explicit String(unsigned long long value) : value(std::to_string(value)) {}
+  explicit String(char value) : value(1, value) {}
+  explicit String(float value, unsigned int decimals = 2);
+
+  const char *c_str() const { return this->value.c_str(); }
+  size_t length() const { return this->value.size(); }
+  bool isEmpty() const { return this->value.empty(); }
+
+  String &operator+=(const String &other) { this->value += other.value; return *this; }
+  String &operator+=(char other) { this->value += other; return *this; }
+  bool operator==(const char *other) const { return this->value == other; }
+  bool operator!=(const char *other) const { return this->value != other; }
+
+  const char *begin() const { return this->value.data(); }
+  const char *end() const { return this->value.data() + this->value.size(); }
+
+private:
+  std::string value;
+};
+
+inline String operator+(const String &a, const String &b) { return String(std::string(a.c_str()) + b.c_str()); }
+
+//? Serial, printed to stdout
+class HostSerial
+{
+public:
+  void begin(unsigned long baud) {}
+  void print(const char *text) { fputs(text, stdout); }
+  void print(const String &text) { fputs(text.c_str(), stdout); }
+  void println(const char *text = "") { puts(text); }
+  void println(const String &text) { puts(text.c_str()); }
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HostSerial Serial;
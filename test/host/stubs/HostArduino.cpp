@@ -0,0 +1,76 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <stdarg.h>
+#include <chrono>
+#include <random>
+#include <thread>
+
+HostSerial Serial;
+WiFiClass WiFi;
+
+static bool clock_frozen = false;
+static uint64_t frozen_us = 0;
+
+static uint64_t get_time_us() {
+  if(clock_frozen) return frozen_us;
+
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+//? Time
+unsigned long millis() {
+  return (unsigned long) (uint32_t) (get_time_us() / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long) (uint32_t) get_time_us();
+}
+
+void delay(unsigned long ms) {
+  if(clock_frozen) {
+    frozen_us += ms * 1000ULL;
+    return;
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void host_freeze_clock(uint64_t start_us) {
+  clock_frozen = true;
+  frozen_us = start_us;
+}
+
+void host_advance_us(uint64_t us) {
+  frozen_us += us;
+}
+
+//? GPIO
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t value) {}
+int digitalRead(uint8_t pin) { return LOW; }
+
+uint32_t esp_random() {
+  static std::mt19937 generator(std::random_device{}());
+  return generator();
+}
+
+//? String and Serial
+String::String(float value, unsigned int decimals) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.*f", decimals, value);
+  this->value = text;
+}
+
+int HostSerial::printf(const char *format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  int length = vprintf(format, arguments);
+  va_end(arguments);
+  return length;
+}
+
+//? WiFi, the host network is always up
+int WiFiClass::status() { return WL_CONNECTED; }
+void WiFiClass::begin(const char *ssid, const char *pass) {}
+bool WiFiClass::isConnected() { return true; }
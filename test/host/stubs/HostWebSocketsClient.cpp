@@ -0,0 +1,371 @@
+#include <WebSocketsClient.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define OPCODE_TEXT 0x1
+#define OPCODE_BINARY 0x2
+#define OPCODE_CLOSE 0x8
+#define OPCODE_PING 0x9
+
+// Largest handshake response read before giving up
+#define HANDSHAKE_MAX_SIZE 4096
+
+// Payloads shorter than this, sent without headerToPayload, are copied to the heap behind their header
+#define COPY_MAX_SIZE 1400
+
+static const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string encode_base64(const uint8_t *data, size_t length) {
+  std::string text;
+  for(size_t index = 0; index < length; index += 3) {
+    uint32_t block = (uint32_t) data[index] << 16;
+    if(index + 1 < length) block |= (uint32_t) data[index + 1] << 8;
+    if(index + 2 < length) block |= data[index + 2];
+
+    text += BASE64[block >> 18 & 0x3F];
+    text += BASE64[block >> 12 & 0x3F];
+    text += index + 1 < length ? BASE64[block >> 6 & 0x3F] : '=';
+    text += index + 2 < length ? BASE64[block & 0x3F] : '=';
+  }
+  return text;
+}
+
+// Client frames are always masked: 2 bytes, the extended length, then the 4 byte mask
+static size_t get_header_size(size_t length) {
+  return 2 + (length < 126 ? 0 : length <= 0xFFFF ? 2 : 8) + 4;
+}
+
+static void write_header(uint8_t *header, uint8_t opcode, size_t length, const uint8_t mask[4]) {
+  size_t offset = 2;
+  header[0] = 0x80 | opcode;
+
+  if(length < 126) {
+    header[1] = 0x80 | length;
+  }
+  else if(length <= 0xFFFF) {
+    header[1] = 0x80 | 126;
+    header[2] = length >> 8;
+    header[3] = length;
+    offset = 4;
+  }
+  else {
+    header[1] = 0x80 | 127;
+    for(uint8_t index = 0; index < 8; index++) header[2 + index] = (uint64_t) length >> (56 - 8 * index);
+    offset = 10;
+  }
+
+  memcpy(header + offset, mask, 4);
+}
+
+static void make_mask(uint8_t mask[4]) {
+  uint32_t random = esp_random();
+  memcpy(mask, &random, 4);
+}
+
+
+WebSocketsClient::~WebSocketsClient() {
+  this->close_socket(false);
+}
+
+void WebSocketsClient::begin(const char *host, uint16_t port, const char *url, const char *protocol) {
+  this->close_socket(false);
+  this->host = host;
+  this->port = port;
+  this->url = url;
+  this->protocol = protocol;
+  this->connect_pending = true;
+}
+
+void WebSocketsClient::onEvent(WebSocketClientEvent event) {
+  this->event = event;
+}
+
+void WebSocketsClient::setExtraHeaders(const char *headers) {
+  this->extra_headers = headers != nullptr ? headers : "";
+}
+
+// One attempt per begin(), WebSocketManager decides when to try again
+void WebSocketsClient::setReconnectInterval(unsigned long time) {}
+
+bool WebSocketsClient::isConnected() {
+  return this->socket_fd >= 0;
+}
+
+void WebSocketsClient::disconnect() {
+  this->connect_pending = false;
+  if(this->socket_fd < 0) return;
+
+  this->send_frame(OPCODE_CLOSE, nullptr, 0);
+  this->close_socket(true);
+}
+
+
+
+//? Connecting
+bool WebSocketsClient::connect_socket() {
+  char port_text[8];
+  snprintf(port_text, sizeof(port_text), "%u", this->port);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  if(getaddrinfo(this->host.c_str(), port_text, &hints, &addresses) != 0) return false;
+
+  for(addrinfo *address = addresses; address != nullptr && this->socket_fd < 0; address = address->ai_next) {
+    int socket_fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if(socket_fd < 0) continue;
+
+    if(connect(socket_fd, address->ai_addr, address->ai_addrlen) == 0) this->socket_fd = socket_fd;
+    else close(socket_fd);
+  }
+  freeaddrinfo(addresses);
+  if(this->socket_fd < 0) return false;
+
+  // Every frame goes out when it's sent, like the ESP32 client with its small buffers
+  int enabled = 1;
+  setsockopt(this->socket_fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+
+  // Don't wait forever for a server that never answers the handshake
+  timeval timeout = { 5, 0 };
+  setsockopt(this->socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  uint8_t key[16];
+  for(uint8_t index = 0; index < sizeof(key); index += 4) make_mask(key + index);
+
+  std::string request = "GET " + this->url + " HTTP/1.1\r\n"
+    "Host: " + this->host + ":" + port_text + "\r\n"
+    "Connection: Upgrade\r\n"
+    "Upgrade: websocket\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "Sec-WebSocket-Key: " + encode_base64(key, sizeof(key)) + "\r\n"
+    "Sec-WebSocket-Protocol: " + this->protocol + "\r\n";
+  if(!this->extra_headers.empty()) request += this->extra_headers + "\r\n";
+  request += "\r\n";
+
+  if(!this->send_all((const uint8_t *) request.data(), request.size())) {
+    this->close_socket(false);
+    return false;
+  }
+
+  // Read the response up to the end of its headers
+  std::string response;
+  size_t end = std::string::npos;
+  while(end == std::string::npos && response.size() < HANDSHAKE_MAX_SIZE) {
+    char buffer[512];
+    ssize_t length = recv(this->socket_fd, buffer, sizeof(buffer), 0);
+    if(length <= 0) break;
+
+    response.append(buffer, length);
+    end = response.find("\r\n\r\n");
+  }
+
+  if(end == std::string::npos || response.compare(0, 12, "HTTP/1.1 101") != 0) {
+    this->close_socket(false);
+    return false;
+  }
+
+  // Frames right behind the handshake
+  this->received.assign(response.begin() + end + 4, response.end());
+  return true;
+}
+
+void WebSocketsClient::close_socket(bool notify) {
+  if(this->socket_fd < 0) return;
+
+  close(this->socket_fd);
+  this->socket_fd = -1;
+  this->received.clear();
+
+  if(notify && this->event != nullptr) this->event(WStype_DISCONNECTED, nullptr, 0);
+}
+
+
+
+//? Sending
+bool WebSocketsClient::send_all(const uint8_t *data, size_t length) {
+  while(length > 0) {
+    ssize_t sent = send(this->socket_fd, data, length, MSG_NOSIGNAL);
+    if(sent < 0 && errno == EINTR) continue;
+    if(sent <= 0) return false;
+
+    data += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+bool WebSocketsClient::send_frame(uint8_t opcode, uint8_t *payload, size_t length, bool headerToPayload) {
+  if(!headerToPayload) return this->send_frame(opcode, (const uint8_t *) payload, length);
+  if(this->socket_fd < 0) return false;
+
+  uint8_t mask[4];
+  make_mask(mask);
+
+  // Header goes right in front of the message, which is masked in place
+  uint8_t *message = payload + WEBSOCKETS_MAX_HEADER_SIZE;
+  uint8_t *frame = message - get_header_size(length);
+  write_header(frame, opcode, length, mask);
+  for(size_t index = 0; index < length; index++) message[index] ^= mask[index & 3];
+
+  if(this->send_all(frame, message + length - frame)) return true;
+
+  this->close_socket(true);
+  return false;
+}
+
+bool WebSocketsClient::send_frame(uint8_t opcode, const uint8_t *payload, size_t length) {
+  if(this->socket_fd < 0) return false;
+
+  uint8_t mask[4];
+  make_mask(mask);
+
+  // The library mallocs a copy to send it in one TCP packet, new[] here so the benchmark counts it
+  if(length > 0 && length < COPY_MAX_SIZE) {
+    uint8_t *copy = new uint8_t[WEBSOCKETS_MAX_HEADER_SIZE + length];
+    memcpy(copy + WEBSOCKETS_MAX_HEADER_SIZE, payload, length);
+    bool result = this->send_frame(opcode, copy, length, true);
+    delete[] copy;
+    return result;
+  }
+
+  // The caller's buffer can't be masked, copy it in chunks behind the header
+  uint8_t buffer[WEBSOCKETS_MAX_HEADER_SIZE + 1024];
+  size_t used = get_header_size(length);
+  write_header(buffer, opcode, length, mask);
+
+  size_t offset = 0;
+  do {
+    while(offset < length && used < sizeof(buffer)) {
+      buffer[used++] = payload[offset] ^ mask[offset & 3];
+      offset++;
+    }
+
+    if(!this->send_all(buffer, used)) {
+      this->close_socket(true);
+      return false;
+    }
+    used = 0;
+  } while(offset < length);
+
+  return true;
+}
+
+bool WebSocketsClient::sendTXT(uint8_t *payload, size_t length, bool headerToPayload) {
+  if(length == 0) length = strlen((const char *) payload + (headerToPayload ? WEBSOCKETS_MAX_HEADER_SIZE : 0));
+  return this->send_frame(OPCODE_TEXT, payload, length, headerToPayload);
+}
+
+bool WebSocketsClient::sendTXT(const char *payload, size_t length) {
+  if(length == 0) length = strlen(payload);
+  return this->send_frame(OPCODE_TEXT, (const uint8_t *) payload, length);
+}
+
+bool WebSocketsClient::sendBIN(uint8_t *payload, size_t length, bool headerToPayload) {
+  return this->send_frame(OPCODE_BINARY, payload, length, headerToPayload);
+}
+
+bool WebSocketsClient::sendBIN(const uint8_t *payload, size_t length) {
+  return this->send_frame(OPCODE_BINARY, payload, length);
+}
+
+
+
+//? Receiving
+void WebSocketsClient::loop() {
+  if(this->socket_fd < 0) {
+    if(!this->connect_pending) return;
+
+    this->connect_pending = false;
+    if(this->connect_socket() && this->event != nullptr) {
+      this->event(WStype_CONNECTED, (uint8_t *) this->url.data(), this->url.size());
+    }
+    return;
+  }
+
+  // Take whatever arrived, never wait for more
+  uint8_t buffer[4096];
+  while(true) {
+    ssize_t length = recv(this->socket_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if(length > 0) {
+      this->received.insert(this->received.end(), buffer, buffer + length);
+      continue;
+    }
+
+    if(length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) break;
+
+    // Closed by the server
+    this->close_socket(true);
+    return;
+  }
+
+  this->handle_frames();
+}
+
+void WebSocketsClient::handle_frames() {
+  while(this->socket_fd >= 0 && this->received.size() >= 2) {
+    uint8_t *data = this->received.data();
+    uint8_t opcode = data[0] & 0x0F;
+    bool masked = data[1] & 0x80;
+    uint64_t length = data[1] & 0x7F;
+    size_t offset = 2;
+
+    if(length == 126) {
+      if(this->received.size() < 4) return;
+      length = (uint64_t) data[2] << 8 | data[3];
+      offset = 4;
+    }
+    else if(length == 127) {
+      if(this->received.size() < 10) return;
+      length = 0;
+      for(uint8_t index = 0; index < 8; index++) length = length << 8 | data[2 + index];
+      offset = 10;
+    }
+
+    size_t mask_offset = offset;
+    if(masked) offset += 4;
+    if(this->received.size() < offset + length) return;
+
+    // Text is handed over null terminated, like the library does, so keep a spare byte after the frame
+    this->received.push_back(0);
+    data = this->received.data();
+    uint8_t *payload = data + offset;
+    if(masked) {
+      for(size_t index = 0; index < length; index++) payload[index] ^= data[mask_offset + (index & 3)];
+    }
+
+    uint8_t following = payload[length];
+    payload[length] = 0;
+
+    switch (opcode) {
+      case OPCODE_TEXT:
+        if(this->event != nullptr) this->event(WStype_TEXT, payload, length);
+        break;
+
+      case OPCODE_BINARY:
+        if(this->event != nullptr) this->event(WStype_BIN, payload, length);
+        break;
+
+      case OPCODE_PING:
+        this->send_frame(0xA, payload, length);
+        break;
+
+      case OPCODE_CLOSE:
+        this->send_frame(OPCODE_CLOSE, nullptr, 0);
+        this->close_socket(true);
+        return;
+    }
+
+    // The listener may have disconnected
+    if(this->socket_fd < 0) return;
+
+    payload[length] = following;
+    this->received.pop_back();
+    this->received.erase(this->received.begin(), this->received.begin() + offset + length);
+  }
+}
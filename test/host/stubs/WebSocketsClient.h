@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+// Same as the library, room kept in front of the payload when headerToPayload is set
+#define WEBSOCKETS_MAX_HEADER_SIZE (14)
+
+typedef enum {
+  WStype_ERROR,
+  WStype_DISCONNECTED,
+  WStype_CONNECTED,
+  WStype_TEXT,
+  WStype_BIN,
+  WStype_FRAGMENT_TEXT_START,
+  WStype_FRAGMENT_BIN_START,
+  WStype_FRAGMENT,
+  WStype_FRAGMENT_FIN,
+  WStype_PING,
+  WStype_PONG,
+} WStype_t;
+
+/**
+ * @brief The part of the arduinoWebSockets client WebSocketManager uses, over a plain POSIX socket
+ * @details Real RFC 6455 frames: masked, header written in front of the payload when headerToPayload is set
+ *          and the payload masked in place, like the library does. Connecting blocks until the handshake is done,
+ *          which is fine against test/host/loopback_server.py. Nothing is allocated while sending with
+ *          headerToPayload, without it a payload under 1400 bytes is copied to the heap like the library does.
+ */
+class WebSocketsClient
+{
+public:
+  typedef void (*WebSocketClientEvent)(WStype_t type, uint8_t *payload, size_t length);
+
+  ~WebSocketsClient();
+
+  // Connection is made by the next loop(), like the library
+  void begin(const char *host, uint16_t port, const char *url = "/", const char *protocol = "arduino");
+  void onEvent(WebSocketClientEvent event);
+  void setExtraHeaders(const char *headers);
+  void setReconnectInterval(unsigned long time);
+
+  bool isConnected();
+  void loop();
+  void disconnect();
+
+  bool sendTXT(uint8_t *payload, size_t length = 0, bool headerToPayload = false);
+  bool sendTXT(const char *payload, size_t length = 0);
+  bool sendBIN(uint8_t *payload, size_t length, bool headerToPayload = false);
+  bool sendBIN(const uint8_t *payload, size_t length);
+
+private:
+  std::string host;
+  uint16_t port = 0;
+  std::string url;
+  std::string protocol;
+  std::string extra_headers;
+  WebSocketClientEvent event = nullptr;
+
+  int socket_fd = -1;
+  bool connect_pending = false;
+  std::vector<uint8_t> received;
+
+  bool connect_socket();
+  bool send_all(const uint8_t *data, size_t length);
+  bool send_frame(uint8_t opcode, uint8_t *payload, size_t length, bool headerToPayload);
+  bool send_frame(uint8_t opcode, const uint8_t *payload, size_t length);
+  void handle_frames();
+  void close_socket(bool notify);
+};
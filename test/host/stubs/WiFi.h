@@ -0,0 +1,16 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define WL_CONNECTED 3
+
+// The host is always connected, WebSocketManager goes straight to connecting
+class WiFiClass
+{
+public:
+  int status();
+  void begin(const char *ssid, const char *pass);
+  bool isConnected();
+};
+
+extern WiFiClass WiFi;
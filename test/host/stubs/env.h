@@ -0,0 +1,8 @@
+#pragma once
+
+// Host build settings, the WebSocket benchmark connects to test/host/loopback_server.py
+#define ENV_WIFI_SSID "host"
+#define ENV_WIFI_PASS "host"
+#define ENV_WS_ADDR "127.0.0.1"
+#define ENV_COOKIE "Cookie: access_token=host-bench"
+#define ENV_DEVICE_NAME "wms-host"
@@ -0,0 +1,132 @@
+/**
+ * @brief TelemetryFrame encode/decode round trip, malformed input, size against the text protocol and throughput
+ * @note Built and run by test/host/run.sh
+ */
+#include <TelemetryFrame.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#define THROUGHPUT_FRAMES 1000000
+
+static int failures = 0;
+
+#define CHECK_EQUAL(actual, expected) check_equal(__LINE__, #actual, (uint64_t) (actual), (uint64_t) (expected))
+
+static void check_equal(int line, const char *name, uint64_t actual, uint64_t expected) {
+  if(actual == expected) return;
+
+  printf("telemetry_frame_test.cpp:%d: %s is %llu, expected %llu\n", line, name, (unsigned long long) actual, (unsigned long long) expected);
+  failures++;
+}
+
+static TelemetryFrame make_flow_frame(uint32_t sequence) {
+  TelemetryFrame frame = {};
+  frame.kind = TELEMETRY_FRAME_FLOW;
+  frame.sequence = sequence;
+  frame.timestamp = 1760000000;
+  frame.value_count = 2;
+  frame.values[0] = 6170;
+  frame.values[1] = 6170;
+  return frame;
+}
+
+
+//? Round trip
+static void test_round_trip() {
+  uint8_t buffer[TELEMETRY_FRAME_MAX_SIZE];
+
+  TelemetryFrame frame = make_flow_frame(1234);
+  size_t length = frame.encode(buffer, sizeof(buffer));
+  CHECK_EQUAL(length, TELEMETRY_FRAME_HEADER_SIZE + 2 * 4);
+  CHECK_EQUAL(length, frame.get_size());
+
+  TelemetryFrame received = {};
+  CHECK_EQUAL(received.decode(buffer, length), true);
+  CHECK_EQUAL(received.kind, TELEMETRY_FRAME_FLOW);
+  CHECK_EQUAL(received.sequence, 1234);
+  CHECK_EQUAL(received.timestamp, 1760000000);
+  CHECK_EQUAL(received.value_count, 2);
+  CHECK_EQUAL(received.values[0], 6170);
+  CHECK_EQUAL(received.values[1], 6170);
+
+  // Every value slot, with every byte of a value set
+  TelemetryFrame full = {};
+  full.kind = TELEMETRY_FRAME_SNAPSHOT;
+  full.sequence = 0xFFFFFFFF;
+  full.timestamp = 0x01020304;
+  full.value_count = TELEMETRY_FRAME_MAX_VALUES;
+  for(uint8_t index = 0; index < TELEMETRY_FRAME_MAX_VALUES; index++) full.values[index] = 0x80000000u | (index * 0x01010101u);
+
+  length = full.encode(buffer, sizeof(buffer));
+  CHECK_EQUAL(length, TELEMETRY_FRAME_MAX_SIZE);
+  CHECK_EQUAL(received.decode(buffer, length), true);
+  CHECK_EQUAL(received.sequence, 0xFFFFFFFF);
+  CHECK_EQUAL(received.timestamp, 0x01020304);
+  CHECK_EQUAL(received.value_count, TELEMETRY_FRAME_MAX_VALUES);
+  for(uint8_t index = 0; index < TELEMETRY_FRAME_MAX_VALUES; index++) CHECK_EQUAL(received.values[index], full.values[index]);
+}
+
+//? Malformed input
+static void test_rejected() {
+  uint8_t buffer[TELEMETRY_FRAME_MAX_SIZE + 4];
+  TelemetryFrame frame = make_flow_frame(1);
+  size_t length = frame.encode(buffer, sizeof(buffer));
+
+  TelemetryFrame received = {};
+  CHECK_EQUAL(received.decode(buffer, length - 1), false);   // Cut short
+  CHECK_EQUAL(received.decode(buffer, length + 1), false);   // Trailing byte
+  CHECK_EQUAL(received.decode(buffer, 3), false);            // Shorter than the header
+
+  buffer[0] = TELEMETRY_FRAME_VERSION + 1;
+  CHECK_EQUAL(received.decode(buffer, length), false);       // Unknown version
+
+  // Doesn't fit the buffer, or more values than a frame holds
+  CHECK_EQUAL(frame.encode(buffer, length - 1), 0);
+  frame.value_count = TELEMETRY_FRAME_MAX_VALUES + 1;
+  CHECK_EQUAL(frame.encode(buffer, sizeof(buffer)), 0);
+}
+
+//? Size against the text protocol
+static void test_size() {
+  TelemetryFrame frame = make_flow_frame(1234);
+
+  // The same content as "key=value" text
+  char text[64];
+  int text_length = snprintf(text, sizeof(text), "seq=%u&ts=%u&f1=%u&f2=%u", frame.sequence, frame.timestamp, frame.values[0], frame.values[1]);
+
+  printf("telemetry_frame_test: 2 sensor flow, binary %u bytes, text %d bytes (%s)\n", (unsigned) frame.get_size(), text_length, text);
+  CHECK_EQUAL(frame.get_size() < (size_t) text_length, true);
+}
+
+//? Throughput
+static void test_throughput() {
+  uint8_t buffer[TELEMETRY_FRAME_MAX_SIZE];
+  TelemetryFrame frame = make_flow_frame(0);
+  TelemetryFrame received = {};
+  uint64_t checksum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t index = 0; index < THROUGHPUT_FRAMES; index++) {
+    frame.sequence = index;
+    size_t length = frame.encode(buffer, sizeof(buffer));
+    if(!received.decode(buffer, length)) failures++;
+    checksum += received.sequence;
+  }
+  double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+  // Every frame came back with its own sequence
+  CHECK_EQUAL(checksum, (uint64_t) THROUGHPUT_FRAMES * (THROUGHPUT_FRAMES - 1) / 2);
+  printf("telemetry_frame_test: encode + decode %.1f ns per frame, %.0f frames/s\n", elapsed_ns / THROUGHPUT_FRAMES, THROUGHPUT_FRAMES * 1e9 / elapsed_ns);
+}
+
+
+int main() {
+  test_round_trip();
+  test_rejected();
+  test_size();
+  test_throughput();
+
+  printf("telemetry_frame_test: %s\n", failures == 0 ? "passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,275 @@
+/**
+ * @brief WebSocketManager throughput against test/host/loopback_server.py, text and binary snapshots
+ * @details Reports messages/s, bytes/s, exact p50/p99/max time from put() to the end of launch(), and heap
+ *          allocations per message counted by replacing operator new. The server counts what it got, and the
+ *          count has to match what was sent. Also checks that a wrong cookie is refused.
+ *          The "string" variant is put() as it was before the fixed buffer, String(data) appended to a String
+ *          and sent with sendTXT(String &), on a connection of its own.
+ * @note Built and run by test/host/run.sh, which starts the server
+ *
+ *   websocket_benchmark <port> [messages]
+ */
+#include <WebSocketManager.h>
+#include <env.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <vector>
+
+#define DEFAULT_MESSAGES 20000
+#define SENSOR_COUNT 2
+#define SERVER_TIMEOUT_MS 10000
+
+static int failures = 0;
+static WebSocketManager ws_manager;
+
+// Server reply to "bench-end"
+static bool counts_received = false;
+static uint32_t server_messages = 0;
+static uint64_t server_bytes = 0;
+
+//? Allocation counting, every heap allocation in the process goes through here
+static uint64_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *pointer = malloc(size != 0 ? size : 1);
+  if(pointer == nullptr) throw std::bad_alloc();
+  return pointer;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept { free(pointer); }
+void operator delete[](void *pointer) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t size) noexcept { free(pointer); }
+void operator delete[](void *pointer, size_t size) noexcept { free(pointer); }
+
+
+static void on_data(WStype_t type, uint8_t *payload, size_t length) {
+  unsigned messages = 0;
+  unsigned long long bytes = 0;
+  if(type == WStype_TEXT && sscanf((const char *) payload, "bench-received=%u,%llu", &messages, &bytes) == 2) {
+    server_messages = messages;
+    server_bytes = bytes;
+    counts_received = true;
+  }
+}
+
+//? String variant, the old put() and launch()
+static WebSocketsClient string_client;
+static String string_payload;
+static WebSocketStats string_stats = {};
+
+template <typename T>
+static void string_put(const T &data) {
+  string_payload += String(data);
+}
+
+// sendTXT(String &) of the library is sendTXT(payload.c_str(), payload.length()), no room for the header
+static void string_launch() {
+  if(string_client.sendTXT(string_payload.c_str(), string_payload.length())) {
+    string_stats.messages++;
+    string_stats.bytes += string_payload.length();
+  }
+  string_payload = "";
+}
+
+
+static bool wait_for(bool (*done)()) {
+  uint32_t start_time = millis();
+  while(!done()) {
+    if(millis() - start_time > SERVER_TIMEOUT_MS) return false;
+    ws_manager.loop();
+    string_client.loop();
+    delay(1);
+  }
+  return true;
+}
+
+// What launch_snapshot() sends per sensor
+struct SensorReading
+{
+  uint32_t flow_rate_mlpm;
+  uint64_t total_millilitres;
+  uint64_t total_pulses;
+  uint8_t leak_state;
+};
+
+// Totals large enough to need 64 bits
+static SensorReading make_sensor(uint32_t index, uint8_t sensor) {
+  SensorReading reading = {};
+  reading.flow_rate_mlpm = 6170 + index % 50;
+  reading.total_millilitres = 5000000000ULL + index * 103ULL + sensor;
+  reading.total_pulses = 2250000000000ULL + index * 46ULL + sensor;
+  return reading;
+}
+
+static void send_text(uint32_t index) {
+  ws_manager.put("snap=");
+  for(uint8_t sensor = 0; sensor < SENSOR_COUNT; sensor++) {
+    SensorReading snapshot = make_sensor(index, sensor);
+    if(sensor > 0) ws_manager.put(';');
+
+    ws_manager.put(snapshot.flow_rate_mlpm);
+    ws_manager.put(',');
+    ws_manager.put(snapshot.total_millilitres);
+    ws_manager.put(',');
+    ws_manager.put(snapshot.total_pulses);
+    ws_manager.put(',');
+    ws_manager.put(snapshot.leak_state);
+  }
+  ws_manager.launch();
+}
+
+static void send_string(uint32_t index) {
+  string_put("snap=");
+  for(uint8_t sensor = 0; sensor < SENSOR_COUNT; sensor++) {
+    SensorReading snapshot = make_sensor(index, sensor);
+    if(sensor > 0) string_put(';');
+
+    string_put(snapshot.flow_rate_mlpm);
+    string_put(',');
+    string_put(snapshot.total_millilitres);
+    string_put(',');
+    string_put(snapshot.total_pulses);
+    string_put(',');
+    string_put(snapshot.leak_state);
+  }
+  string_launch();
+}
+
+static void send_binary(uint32_t index) {
+  TelemetryFrame frame = {};
+  frame.kind = TELEMETRY_FRAME_SNAPSHOT;
+  frame.timestamp = 1760000000 + index;
+  frame.value_count = SENSOR_COUNT * TELEMETRY_FRAME_SNAPSHOT_VALUES;
+
+  for(uint8_t sensor = 0; sensor < SENSOR_COUNT; sensor++) {
+    SensorReading snapshot = make_sensor(index, sensor);
+    uint32_t *values = frame.values + sensor * TELEMETRY_FRAME_SNAPSHOT_VALUES;
+    values[0] = snapshot.flow_rate_mlpm;
+    values[1] = (uint32_t) snapshot.total_millilitres;
+    values[2] = (uint32_t) (snapshot.total_millilitres >> 32);
+    values[3] = (uint32_t) snapshot.total_pulses;
+    values[4] = (uint32_t) (snapshot.total_pulses >> 32);
+    values[5] = snapshot.leak_state;
+  }
+  ws_manager.launch(frame);
+}
+
+// One way of sending, what it sent so far, and how it tells the server the burst is over
+struct Variant
+{
+  const char *name;
+  void (*send_message)(uint32_t index);
+  const WebSocketStats &(*get_stats)();
+  void (*end)();
+  bool device_stats;  // The stats come from WebSocketManager, latency histogram included
+};
+
+static const Variant VARIANTS[] = {
+  { "string", send_string, []() -> const WebSocketStats & { return string_stats; },
+    []() { string_put("bench-end"); string_launch(); }, false },
+  { "text", send_text, []() -> const WebSocketStats & { return ws_manager.get_stats(); },
+    []() { ws_manager.put("bench-end"); ws_manager.launch(); }, true },
+  { "binary", send_binary, []() -> const WebSocketStats & { return ws_manager.get_stats(); },
+    []() { ws_manager.put("bench-end"); ws_manager.launch(); }, true },
+};
+
+static void run(const Variant &variant, uint32_t count) {
+  const char *name = variant.name;
+  std::vector<uint32_t> latencies_ns(count);
+  WebSocketStats before = variant.get_stats();
+  uint64_t allocations_before = allocations;
+
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t index = 0; index < count; index++) {
+    auto message_start = std::chrono::steady_clock::now();
+    variant.send_message(index);
+    latencies_ns[index] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - message_start).count();
+  }
+  double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  uint64_t burst_allocations = allocations - allocations_before;
+
+  const WebSocketStats &after = variant.get_stats();
+  WebSocketStats burst = {};
+  burst.messages = after.messages - before.messages;
+  burst.bytes = after.bytes - before.bytes;
+  for(uint8_t bucket = 0; bucket < WS_LATENCY_BUCKETS; bucket++) {
+    burst.latency_histogram[bucket] = after.latency_histogram[bucket] - before.latency_histogram[bucket];
+  }
+
+  // Everything was sent right away, nothing queued or dropped
+  if(burst.messages != count || after.dropped != before.dropped) {
+    printf("websocket_benchmark: %s sent %u of %u messages, %u dropped\n", name, burst.messages, count, after.dropped - before.dropped);
+    failures++;
+  }
+
+  // And the server got all of it
+  counts_received = false;
+  variant.end();
+  if(!wait_for([]() { return counts_received; })) {
+    printf("websocket_benchmark: %s, no count from the server\n", name);
+    failures++;
+    return;
+  }
+  if(server_messages != burst.messages || server_bytes != burst.bytes) {
+    printf("websocket_benchmark: %s, server got %u messages and %llu bytes, sent %u and %llu\n",
+           name, server_messages, (unsigned long long) server_bytes, burst.messages, (unsigned long long) burst.bytes);
+    failures++;
+  }
+
+  std::sort(latencies_ns.begin(), latencies_ns.end());
+  printf("%-6s %6u messages %5.1f bytes each  %8.0f msg/s  %10.0f bytes/s  p50 %6.2f us  p99 %6.2f us  max %8.2f us  %.2f allocations/message\n",
+         name, count, (double) burst.bytes / count, count / elapsed_s, burst.bytes / elapsed_s,
+         latencies_ns[count / 2] / 1000.0, latencies_ns[(uint64_t) count * 99 / 100] / 1000.0, latencies_ns[count - 1] / 1000.0,
+         (double) burst_allocations / count);
+  if(variant.device_stats) {
+    printf("%-6s device histogram: p50 bound %u us, p99 bound %u us\n", name, burst.get_latency_bound(50), burst.get_latency_bound(99));
+  }
+}
+
+// The server has to refuse anyone without the device cookie
+static void check_cookie_refused(uint16_t port) {
+  WebSocketsClient client;
+  client.setExtraHeaders("Cookie: access_token=wrong");
+  client.begin(ENV_WS_ADDR, port);
+  client.loop();
+
+  if(client.isConnected()) {
+    printf("websocket_benchmark: connected with a wrong cookie\n");
+    failures++;
+  }
+}
+
+
+int main(int argc, char **argv) {
+  if(argc < 2) {
+    printf("usage: websocket_benchmark <port> [messages]\n");
+    return 2;
+  }
+  uint16_t port = atoi(argv[1]);
+  uint32_t count = argc > 2 ? strtoul(argv[2], nullptr, 10) : DEFAULT_MESSAGES;
+  if(count == 0) count = 1;
+
+  check_cookie_refused(port);
+
+  ws_manager.listen(on_data);
+  ws_manager.init(ENV_WS_ADDR, port);
+  string_client.onEvent(on_data);
+  string_client.setExtraHeaders(ENV_COOKIE);
+  string_client.begin(ENV_WS_ADDR, port);
+  if(!wait_for([]() { return ws_manager.get_state() == WS_STATE_CONNECTED && string_client.isConnected(); })) {
+    printf("websocket_benchmark: can't connect to %s:%u\n", ENV_WS_ADDR, port);
+    return 1;
+  }
+
+  printf("websocket_benchmark: %u sensor snapshots to %s:%u\n", SENSOR_COUNT, ENV_WS_ADDR, port);
+  for(const Variant &variant : VARIANTS) run(variant, count);
+
+  printf("websocket_benchmark: %s\n", failures == 0 ? "passed" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}